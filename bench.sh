@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# bench.sh runs r.refine on the synthetic DEMs of bench_dem at fixed
+# errors and memory sizes and reports the throughput of each run in
+# cells/s and triangles/s. Run it with "make -f Makefile.linux bench".
+#
+# The DEMs are written once to $BENCH_DIR and reused. The runs are set
+# with the environment:
+#
+#   BENCH_DIR    directory of the DEMs and outputs (default bench.out)
+#   BENCH_TYPES  DEM types (default "fbm plateau noise mask")
+#   BENCH_SIZES  sides of the square DEMs (default "500 1000 2000")
+#   BENCH_NOISE  largest side of the noise DEMs, which keep almost all
+#                their points (default 500)
+#   BENCH_EPS    errors in percent (default "0.5 2")
+#   BENCH_MEM    memory sizes in MB (default "0.1 2 100"), 0.1 splits
+#                every DEM in hundreds of tiles
+#   BENCH_OPTS   extra r.refine options, e.g. "lazy=1 threads=4"
+#
+# Each line has the phases of the run in seconds: ingest (tiling the
+# grid), refine (refinement and output) and write (TIN output alone),
+# from the stats= file of r.refine.
+#
+
+BENCH_DIR=${BENCH_DIR:-bench.out}
+BENCH_TYPES=${BENCH_TYPES:-"fbm plateau noise mask"}
+BENCH_SIZES=${BENCH_SIZES:-"500 1000 2000"}
+BENCH_NOISE=${BENCH_NOISE:-500}
+BENCH_EPS=${BENCH_EPS:-"0.5 2"}
+BENCH_MEM=${BENCH_MEM:-"0.1 2 100"}
+
+REFINE=./r.refine
+DEM=./bench_dem
+
+if [ ! -x $REFINE ] || [ ! -x $DEM ]; then
+    echo "bench.sh: build r.refine and bench_dem first"
+    exit 1
+fi
+mkdir -p $BENCH_DIR || exit 1
+
+# Value of field $3 of object $1 in the stats file $2, leaving out
+# the per tile counters
+stat() {
+    tr -d '\n' < $2 | sed -e 's/"tiles": \[.*//' \
+	-e "s/.*\"$1\": {[^}]*\"$3\": \([0-9.]*\).*/\1/"
+}
+
+now() {
+    date +%s.%N
+}
+
+printf "%-8s %6s %5s %5s %6s %9s %8s %8s %8s %8s %11s %11s\n" \
+    dem size eps mem tiles triangles total ingest refine write \
+    cells/s tris/s
+
+for type in $BENCH_TYPES; do
+    for size in $BENCH_SIZES; do
+	if [ $type = noise ] && [ $size -gt $BENCH_NOISE ]; then
+	    continue
+	fi
+	asc=$BENCH_DIR/$type-$size.asc
+	if [ ! -f $asc ]; then
+	    $DEM $type $size $size $asc || exit 1
+	fi
+	# nodata is refined as part of the terrain except in the masks
+	nodata=1
+	[ $type = mask ] && nodata=0
+
+	for eps in $BENCH_EPS; do
+	    for mem in $BENCH_MEM; do
+		tin=$BENCH_DIR/out.tin
+		json=$BENCH_DIR/stats.json
+		log=$BENCH_DIR/$type-$size-$eps-$mem.log
+		rm -f $tin $json
+		start=$(now)
+		if ! $REFINE $asc $tin $eps $mem 1 $nodata \
+		    stats=$json $BENCH_OPTS > $log 2>&1; then
+		    echo "$type-$size eps=$eps mem=$mem FAILED, see $log"
+		    continue
+		fi
+		end=$(now)
+
+		tiles=$(stat run $json tiles)
+		tris=$(stat run $json triangles)
+		total=$(stat total $json wall)
+		refine=$(stat refine $json wall)
+		write=$(stat tileWrite $json seconds)
+		awk -v type=$type -v size=$size -v eps=$eps -v mem=$mem \
+		    -v tiles=$tiles -v tris=$tris -v start=$start -v end=$end \
+		    -v total=$total -v refine=$refine -v write=$write 'BEGIN {
+		    wall = end - start
+		    printf "%-8s %6d %5s %5s %6d %9d %8.2f %8.2f %8.2f %8.2f %11.0f %11.0f\n",
+			type, size, eps, mem, tiles, tris, wall, wall - total,
+			refine, write, size * size / wall, tris / wall
+		}'
+	    done
+	done
+    done
+done
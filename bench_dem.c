@@ -0,0 +1,169 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * bench_dem.c writes synthetic DEMs in Arc-ASCII format for the
+ * benchmarks run by bench.sh. The DEMs only depend on their type,
+ * size and seed.
+ *
+ * usage: bench_dem type nrows ncols output.asc [seed]
+ *
+ * types:
+ *   fbm      fractal Brownian terrain
+ *   plateau  flat plateaus separated by cliffs
+ *   noise    uniform random heights
+ *   mask     fractal terrain on a few islands, the rest is nodata
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Nodata value of the mask DEMs
+#define BENCH_NODATA -9999
+
+// Octaves of the fractal terrain
+#define BENCH_OCTAVES 8
+
+static unsigned int benchSeed = 1;
+
+
+//
+// Random value in [0,1) of the lattice point (i,j) of an octave
+//
+double latticeValue(int i, int j, int octave){
+  unsigned int h = benchSeed * 0x9E3779B1u;
+  h ^= (unsigned int)i * 0x85EBCA6Bu;
+  h = (h << 13) | (h >> 19);
+  h ^= (unsigned int)j * 0xC2B2AE35u;
+  h ^= (unsigned int)octave * 0x27D4EB2Fu;
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return h / 4294967296.0;
+}
+
+
+//
+// Value noise in [0,1) at (x,y), interpolated between the lattice
+// points of an octave
+//
+double valueNoise(double x, double y, int octave){
+  int i = (int)floor(x), j = (int)floor(y);
+  double fx = x - i, fy = y - j;
+  double a, b, c, d;
+
+  // smoothstep so the terrain has no creases along the lattice
+  fx = fx * fx * (3 - 2 * fx);
+  fy = fy * fy * (3 - 2 * fy);
+  a = latticeValue(i, j, octave);
+  b = latticeValue(i + 1, j, octave);
+  c = latticeValue(i, j + 1, octave);
+  d = latticeValue(i + 1, j + 1, octave);
+  return (a * (1 - fx) + b * fx) * (1 - fy) + (c * (1 - fx) + d * fx) * fy;
+}
+
+
+//
+// Fractal Brownian motion in [0,1) at cell (row,col). The largest
+// features are about scale cells wide
+//
+double fbm(int row, int col, double scale){
+  double sum = 0, amp = 0.5, norm = 0, f = 1.0 / scale;
+  int k;
+
+  for(k = 0; k < BENCH_OCTAVES; k++){
+    sum += amp * valueNoise(row * f, col * f, k);
+    norm += amp;
+    amp *= 0.5;
+    f *= 2;
+  }
+  return sum / norm;
+}
+
+
+//
+// Height of cell (row,col) of a DEM of the given type
+//
+int cellHeight(char *type, int row, int col, int nrows, int ncols){
+  double scale = (nrows > ncols ? nrows : ncols) / 4.0;
+  double h;
+
+  if(strcmp(type,"fbm") == 0)
+    return (int)(3000 * fbm(row, col, scale));
+
+  if(strcmp(type,"plateau") == 0){
+    // Terraces of a smooth terrain: flat steps of 250 with a little
+    // roughness on top, the steps are the cliffs
+    h = 3000 * fbm(row, col, scale);
+    return 250 * (int)(h / 250) + (int)(4 * valueNoise(row, col, 99));
+  }
+
+  if(strcmp(type,"noise") == 0)
+    return (int)(1000 * latticeValue(row, col, 98));
+
+  if(strcmp(type,"mask") == 0){
+    // Islands where a coarse noise is high, about 10% of the cells
+    if(valueNoise(row / scale * 2, col / scale * 2, 97) < 0.78)
+      return BENCH_NODATA;
+    return (int)(3000 * fbm(row, col, scale));
+  }
+
+  printf("bench_dem: unknown type %s\n", type);
+  exit(1);
+}
+
+
+int main(int argc, char *argv[]){
+  int nrows, ncols, row, col;
+  FILE *fp;
+
+  if(argc < 5){
+    printf("usage: %s fbm|plateau|noise|mask nrows ncols output.asc [seed]\n",
+	   argv[0]);
+    exit(1);
+  }
+  nrows = atoi(argv[2]);
+  ncols = atoi(argv[3]);
+  if(argc > 5)
+    benchSeed = atoi(argv[5]);
+  if(nrows < 2 || ncols < 2 || nrows > 32767 || ncols > 32767){
+    printf("bench_dem: bad size %d x %d\n", nrows, ncols);
+    exit(1);
+  }
+
+  if((fp = fopen(argv[4], "w")) == NULL){
+    fprintf(stderr, "bench_dem: can't write to %s ", argv[4]);
+    perror("bench_dem:");
+    exit(1);
+  }
+
+  fprintf(fp, "ncols %d\nnrows %d\nxllcorner 0\nyllcorner 0\n"
+	  "cellsize 30\nNODATA_value %d\n", ncols, nrows, BENCH_NODATA);
+  for(row = 0; row < nrows; row++){
+    for(col = 0; col < ncols; col++)
+      fprintf(fp, "%d ", cellHeight(argv[1], row, col, nrows, ncols));
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+  return 0;
+}
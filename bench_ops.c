@@ -0,0 +1,317 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * bench_ops.c times the primitives under refineTile in ns/op, apart
+ * from a DEM run: the priority queue, the point lists and the
+ * geometric predicates. Each benchmark runs on fixed pseudo random
+ * data, so a replacement can be compared against the same baseline.
+ *
+ * usage: bench_ops [n]
+ *
+ * n is the number of triangles in the PQ and of points in the lists
+ * (default 1048576). Note the times include the STATS_COUNT of the
+ * primitives unless built with -DNO_STATS.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "point.h"
+#include "triangle.h"
+#include "pqheap.h"
+#include "queue.h"
+#include "tin.h"
+#include "geom_tin.h"
+#include "refine_tin.h"
+#include "rtimer.h"
+
+// Number of triangles and query points of the geometry benchmarks,
+// a power of 2 small enough to stay in cache
+#define BENCH_GEOM_SIZE 4096
+
+// Calls of each geometric predicate
+#define BENCH_GEOM_CALLS (1 << 24)
+
+// Largest coordinate of the geometry benchmarks
+#define BENCH_COORD 1000
+
+static unsigned int benchRand = 2463534242u;
+
+// Results are added here so the calls are not optimized away
+static volatile long benchSink;
+
+
+//
+// xorshift, cheap enough not to weigh on the ns/op
+//
+static inline unsigned int nextRand(){
+  benchRand ^= benchRand << 13;
+  benchRand ^= benchRand >> 17;
+  benchRand ^= benchRand << 5;
+  return benchRand;
+}
+
+
+//
+// Print the time per operation of a benchmark
+//
+void printResult(char *name, unsigned long ops, Rtimer rt){
+  printf("%-28s %10lu ops %9.2f ns/op\n", name, ops,
+	 rt_w_useconds(rt) * 1000 / ops);
+  fflush(stdout);
+}
+
+
+//
+// PQ under the access pattern of the refinement. After filling it
+// with n triangles, each step extracts the triangle with the largest
+// error, deletes a neighbor lost to the split and inserts three
+// children whose errors are at most that of the parent. The fill,
+// the refinement steps, random deletes and the final drain are
+// timed apart
+//
+void benchPQ(unsigned int n){
+  unsigned int size = 3 * n, i, steps = n / 2, ops, numFree;
+  TRIANGLE *tris = (TRIANGLE*)calloc(size, sizeof(TRIANGLE));
+  TRIANGLE **freeTris = (TRIANGLE**)malloc(size * sizeof(TRIANGLE*));
+  R_POINT maxE;
+  PQueue *pq;
+  TRIANGLE *t;
+  Rtimer rt;
+  assert(tris && freeTris);
+
+  // PQ_insert only takes triangles that are not done
+  maxE.x = maxE.y = maxE.z = 0;
+  for(i = 0; i < size; i++){
+    tris[i].maxE = &maxE;
+    freeTris[i] = &tris[size - 1 - i];
+  }
+  numFree = size;
+  pq = PQ_initialize(n);
+
+  rt_start(rt);
+  for(i = 0; i < n; i++){
+    t = freeTris[--numFree];
+    t->maxErrorValue = nextRand() % ELEV_TYPE_MAX;
+    PQ_insert(pq,t);
+  }
+  rt_stop(rt);
+  printResult("PQ_insert (fill)", n, rt);
+
+  ops = 0;
+  rt_start(rt);
+  for(i = 0; i < steps && pq->cursize > 1; i++){
+    ELEV_TYPE err;
+    int k;
+    PQ_extractMin(pq,&t);
+    err = t->maxErrorValue;
+    freeTris[numFree++] = t;
+    t = pq->elements[nextRand() % pq->cursize];
+    PQ_delete(pq,t->pqIndex);
+    freeTris[numFree++] = t;
+    for(k = 0; k < 3; k++){
+      t = freeTris[--numFree];
+      t->maxErrorValue = nextRand() % (err + 1);
+      PQ_insert(pq,t);
+    }
+    ops += 5;
+  }
+  rt_stop(rt);
+  printResult("PQ refine step (per op)", ops, rt);
+
+  ops = pq->cursize / 2;
+  rt_start(rt);
+  for(i = 0; i < ops; i++){
+    t = pq->elements[nextRand() % pq->cursize];
+    PQ_delete(pq,t->pqIndex);
+  }
+  rt_stop(rt);
+  printResult("PQ_delete (random)", ops, rt);
+
+  ops = pq->cursize;
+  rt_start(rt);
+  while(PQ_extractMin(pq,&t))
+    ;
+  rt_stop(rt);
+  printResult("PQ_extractMin (drain)", ops, rt);
+
+  PQ_free(pq);
+  free(freeTris);
+  free(tris);
+}
+
+
+//
+// Point lists as in distrPoints: the n points of a list are moved
+// one by one to the heads of three lists, then back, repeatedly. The
+// list a point goes to depends on the point, and the nodes are
+// linked in random order like the lists of a refined tile
+//
+void benchQueue(unsigned int n){
+  QNODE *nodes = (QNODE*)malloc(n * sizeof(QNODE));
+  QNODE **order = (QNODE**)malloc(n * sizeof(QNODE*));
+  QUEUE src, dst[3];
+  QNODE *cur;
+  unsigned int i, j, pass, passes = 8;
+  unsigned long ops = 0;
+  Rtimer rt;
+  int k;
+  assert(nodes && order);
+
+  src = Q_init();
+  for(k = 0; k < 3; k++)
+    dst[k] = Q_init();
+  for(i = 0; i < n; i++){
+    nodes[i].e.x = nextRand() % BENCH_COORD;
+    nodes[i].e.y = nextRand() % BENCH_COORD;
+    nodes[i].e.z = 0;
+    order[i] = &nodes[i];
+  }
+  for(i = n - 1; i > 0; i--){
+    j = nextRand() % (i + 1);
+    cur = order[i];
+    order[i] = order[j];
+    order[j] = cur;
+  }
+  for(i = 0; i < n; i++)
+    Q_insert_qnode_head(src,order[i]);
+
+  rt_start(rt);
+  for(pass = 0; pass < passes; pass++){
+    while((cur = Q_remove_first(src)) != NULL){
+      Q_insert_qnode_head(dst[(cur->e.x + cur->e.y) % 3],cur);
+      ops++;
+    }
+    for(k = 0; k < 3; k++){
+      while((cur = Q_remove_first(dst[k])) != NULL){
+	Q_insert_qnode_head(src,cur);
+	ops++;
+      }
+    }
+  }
+  rt_stop(rt);
+  printResult("Q_remove_first+insert_head", ops, rt);
+
+  // The nodes are not the queue's to free
+  while(Q_remove_first(src) != NULL)
+    ;
+  Q_free_queue(src);
+  for(k = 0; k < 3; k++)
+    Q_free_queue(dst[k]);
+  free(order);
+  free(nodes);
+}
+
+
+//
+// inTri2D, areaSign, interpolate and CircumCircle on random
+// triangles. The query points are taken in the bounding box of their
+// triangle, so about half are inside like in distrPoints
+//
+void benchGeom(){
+  R_POINT *p = (R_POINT*)malloc(3 * BENCH_GEOM_SIZE * sizeof(R_POINT));
+  R_POINT *q = (R_POINT*)malloc(BENCH_GEOM_SIZE * sizeof(R_POINT));
+  unsigned int i, k, m = BENCH_GEOM_SIZE - 1;
+  long sum;
+  Rtimer rt;
+  assert(p && q);
+
+  for(i = 0; i < BENCH_GEOM_SIZE; i++){
+    R_POINT *a = &p[3*i], *b = &p[3*i+1], *c = &p[3*i+2];
+    COORD_TYPE minX, maxX, minY, maxY;
+    // Counterclockwise and not collinear
+    do{
+      for(k = 0; k < 3; k++){
+	p[3*i+k].x = nextRand() % BENCH_COORD;
+	p[3*i+k].y = nextRand() % BENCH_COORD;
+	p[3*i+k].z = nextRand() % 3000;
+      }
+    } while(areaSign(a,b,c) <= 0);
+    minX = MIN(a->x,MIN(b->x,c->x));
+    maxX = MAX(a->x,MAX(b->x,c->x));
+    minY = MIN(a->y,MIN(b->y,c->y));
+    maxY = MAX(a->y,MAX(b->y,c->y));
+    q[i].x = minX + nextRand() % (maxX - minX + 1);
+    q[i].y = minY + nextRand() % (maxY - minY + 1);
+    q[i].z = 0;
+  }
+
+  sum = 0;
+  rt_start(rt);
+  for(i = 0; i < BENCH_GEOM_CALLS; i++){
+    k = i & m;
+    sum += inTri2D(&p[3*k],&p[3*k+1],&p[3*k+2],&q[k]);
+  }
+  rt_stop(rt);
+  benchSink += sum;
+  printResult("inTri2D", BENCH_GEOM_CALLS, rt);
+
+  sum = 0;
+  rt_start(rt);
+  for(i = 0; i < BENCH_GEOM_CALLS; i++){
+    k = i & m;
+    sum += areaSign(&p[3*k],&p[3*k+1],&q[k]);
+  }
+  rt_stop(rt);
+  benchSink += sum;
+  printResult("areaSign", BENCH_GEOM_CALLS, rt);
+
+  sum = 0;
+  rt_start(rt);
+  for(i = 0; i < BENCH_GEOM_CALLS; i++){
+    k = i & m;
+    sum += interpolate(&p[3*k],&p[3*k+1],&p[3*k+2],q[k].x,q[k].y);
+  }
+  rt_stop(rt);
+  benchSink += sum;
+  printResult("interpolate", BENCH_GEOM_CALLS, rt);
+
+  sum = 0;
+  rt_start(rt);
+  for(i = 0; i < BENCH_GEOM_CALLS; i++){
+    k = i & m;
+    sum += CircumCircle(q[k].x,q[k].y,p[3*k].x,p[3*k].y,
+			p[3*k+1].x,p[3*k+1].y,p[3*k+2].x,p[3*k+2].y);
+  }
+  rt_stop(rt);
+  benchSink += sum;
+  printResult("CircumCircle", BENCH_GEOM_CALLS, rt);
+
+  free(p);
+  free(q);
+}
+
+
+int main(int argc, char *argv[]){
+  unsigned int n = 1048576;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 2){
+    printf("usage: %s [n]\n", argv[0]);
+    exit(1);
+  }
+
+  benchPQ(n);
+  benchQueue(n);
+  benchGeom();
+  return 0;
+}
@@ -0,0 +1,177 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * bench_sort.c compares the two ways of sorting the points of a tile
+ * and giving every cell its place in the sorted array: placing the
+ * points in their cells and collecting them in row major order, and
+ * QS_radixPoints followed by marking the cells. The points are a
+ * random part of the cells of a tile of side TL, so both the dense
+ * tiles of a fine TIN and the sparse ones of a coarse TIN are timed.
+ *
+ * usage: bench_sort [TL ...]
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "point.h"
+#include "qsort.h"
+#include "rtimer.h"
+
+// Fraction of the cells of a tile holding a point
+#define NUM_DENSITIES 3
+static double densities[NUM_DENSITIES] = {1.0, 0.1, 0.01};
+
+
+//
+// Sort the n points of a in a TLxTL tile by placing them in their
+// cell, and set the index of every cell to the place of its point or
+// UINT_MAX
+//
+void placePoints(R_POINT **a, unsigned int n, int tl, unsigned int *index){
+  unsigned int i, k;
+  long c, cells = (long)tl * tl;
+  R_POINT **tmp;
+
+  for(c = 0; c < cells; c++)
+    index[c] = UINT_MAX;
+  for(i = 0; i < n; i++)
+    index[(long)a[i]->x * tl + a[i]->y] = i;
+  tmp = (R_POINT**)malloc(n * sizeof(R_POINT*));
+  assert(tmp);
+  for(c = 0, k = 0; c < cells; c++){
+    if(index[c] != UINT_MAX){
+      tmp[k] = a[index[c]];
+      index[c] = k++;
+    }
+  }
+  assert(k == n);
+  memcpy(a, tmp, n * sizeof(R_POINT*));
+  free(tmp);
+}
+
+
+//
+// Sort the n points of a in a TLxTL tile with QS_radixPoints and set
+// the index of every cell as placePoints does
+//
+void radixPoints(R_POINT **a, unsigned int n, int tl, unsigned int *index){
+  unsigned int i;
+
+  QS_radixPoints(a,n,0,0,tl,tl);
+  memset(index, 0xff, (long)tl * tl * sizeof(unsigned int));
+  for(i = 0; i < n; i++)
+    index[(long)a[i]->x * tl + a[i]->y] = i;
+}
+
+
+//
+// Sort a random part of the cells of a TLxTL tile with both sorts,
+// for every density, and print the times
+//
+void benchTile(int tl){
+  unsigned int i, j, n, cells = (unsigned int)tl * tl;
+  R_POINT *pts = (R_POINT*)malloc(cells * sizeof(R_POINT));
+  R_POINT **all = (R_POINT**)malloc(cells * sizeof(R_POINT*));
+  R_POINT **a = (R_POINT**)malloc(cells * sizeof(R_POINT*));
+  R_POINT **b = (R_POINT**)malloc(cells * sizeof(R_POINT*));
+  unsigned int *ia = (unsigned int*)malloc(cells * sizeof(unsigned int));
+  unsigned int *ib = (unsigned int*)malloc(cells * sizeof(unsigned int));
+  R_POINT *tmp;
+  Rtimer rtPlace, rtRadix;
+  int d;
+  assert(pts && all && a && b && ia && ib);
+
+  // One point per cell, shuffled. The points are allocated in
+  // row major order like the ones of a tile read from file
+  for(i = 0; i < cells; i++){
+    pts[i].x = i / tl;
+    pts[i].y = i % tl;
+    pts[i].z = 0;
+    all[i] = &pts[i];
+  }
+  srand(tl);
+  for(i = cells - 1; i > 0; i--){
+    j = rand() % (i + 1);
+    tmp = all[i];
+    all[i] = all[j];
+    all[j] = tmp;
+  }
+
+  for(d = 0; d < NUM_DENSITIES; d++){
+    // The first n of the shuffled points are a random part of the
+    // cells
+    n = (unsigned int)(cells * densities[d]);
+    for(i = 0; i < n; i++)
+      a[i] = b[i] = all[i];
+
+    rt_start(rtPlace);
+    placePoints(a,n,tl,ia);
+    rt_stop(rtPlace);
+
+    rt_start(rtRadix);
+    radixPoints(b,n,tl,ib);
+    rt_stop(rtRadix);
+
+    // Both must give the same order and index
+    for(i = 0; i < n; i++){
+      if(a[i] != b[i]){
+	printf("bench_sort: sorts differ at %u\n",i);
+	exit(1);
+      }
+    }
+    if(memcmp(ia, ib, cells * sizeof(unsigned int)) != 0){
+      printf("bench_sort: indexes differ\n");
+      exit(1);
+    }
+
+    printf("TL=%5d points=%9u place=%7.3fs radix=%7.3fs speedup=%5.1f\n",
+	   tl, n, rt_seconds(rtPlace), rt_seconds(rtRadix),
+	   rt_seconds(rtPlace) / rt_seconds(rtRadix));
+    fflush(stdout);
+  }
+
+  free(pts);
+  free(all);
+  free(a);
+  free(b);
+  free(ia);
+  free(ib);
+}
+
+
+int main(int argc, char *argv[]){
+  int i;
+
+  if(argc > 1){
+    for(i = 1; i < argc; i++)
+      benchTile(atoi(argv[i]));
+  }
+  else{
+    benchTile(500);
+    benchTile(1000);
+    benchTile(2000);
+    benchTile(3000);
+  }
+  return 0;
+}
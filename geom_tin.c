@@ -30,6 +30,7 @@
  *****************************************************************************/
 
 #include "geom_tin.h"
+#include "stats.h"
 
 
 //
@@ -68,6 +69,17 @@ long interpolate(R_POINT* p1, R_POINT* p2, R_POINT* p3,COORD_TYPE px,
 //
 ELEV_TYPE findError(COORD_TYPE row,COORD_TYPE col,ELEV_TYPE height,
 		    TRIANGLE* t){
+  STATS_COUNT(STAT_FIND_ERROR);
   long err = interpolate(t->p1,t->p2,t->p3, row, col);
   return  fabs((ELEV_TYPE)height-err);
 }
+
+
+//
+// Return the area of t in the (x,y) plane
+//
+double triangleArea(TRIANGLE *t){
+  double d = (double)(t->p2->x - t->p1->x) * (t->p3->y - t->p1->y) - 
+    (double)(t->p3->x - t->p1->x) * (t->p2->y - t->p1->y);
+  return fabs(d) / 2;
+}
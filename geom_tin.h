@@ -55,4 +55,9 @@ long interpolate(R_POINT* p1, R_POINT* p2, R_POINT* p3,COORD_TYPE px,
 ELEV_TYPE findError(COORD_TYPE row,COORD_TYPE col,ELEV_TYPE height,
 		    TRIANGLE* t);
 
+//
+// Return the area of t in the (x,y) plane
+//
+double triangleArea(TRIANGLE *t);
+
 #endif
@@ -179,42 +179,36 @@ void writeVectorTile(struct Map_info *Map, TIN_TILE *tt){
   n_points = 2;
   count = 0;
 
-  // Traverse the TIN crossing over every edge
-  TRIANGLE *curT = tt->t;
-  TRIANGLE *prevT = curT;
+  // Visit every triangle of the tile once. An edge shared by two
+  // triangles of the tile is written by the one at the lower address
+  TRIANGLE *t;
+  R_POINT *pa[3], *pb[3];
+  TRIANGLE *tn[3];
+  unsigned int pos = 0;
+  int k;
   
-  // Create an edge which 
-  EDGE curE;
-  curE.type = IN;
-  curE.t1 = NULL;
-  curE.t2 = tt->t;
-  curE.p1 = tt->e.p1;
-  curE.p2 = tt->e.p2;
-  
-  // Traverse the tin and draw triangles till we get back to the start edge
-  do {
-    
-    
-    xarray[0] = G_col_to_easting((double)curE.p1->y +.5, &w);
-    xarray[1] = G_col_to_easting((double)curE.p2->y +.5, &w);
-    yarray[0] = G_row_to_northing((double)curE.p1->x +.5, &w);
-    yarray[1] = G_row_to_northing((double)curE.p2->x +.5, &w);
-    count++;
+  while((t = nextTri(&tt->tris,&pos)) != NULL){
+    pa[0] = t->p1; pb[0] = t->p2; tn[0] = t->p1p2;
+    pa[1] = t->p1; pb[1] = t->p3; tn[1] = t->p1p3;
+    pa[2] = t->p2; pb[2] = t->p3; tn[2] = t->p2p3;
+
+    for(k = 0; k < 3; k++){
+      if(tn[k] != NULL && tn[k] < t && !edgeOnBoundary(pa[k],pb[k],tt))
+	continue;
+
+      xarray[0] = G_col_to_easting((double)pa[k]->y +.5, &w);
+      xarray[1] = G_col_to_easting((double)pb[k]->y +.5, &w);
+      yarray[0] = G_row_to_northing((double)pa[k]->x +.5, &w);
+      yarray[1] = G_row_to_northing((double)pb[k]->x +.5, &w);
+      count++;
       
-    /* make a vector dig record */
-    if (0 > Vect_copy_xy_to_pnts (Points, xarray, yarray, n_points))
-      G_fatal_error ("Vect_copy error\n");
-
-    Vect_write_line (Map,  (unsigned int) type, Points);
-    
-    
-    // Go to next edge
-    prevT = curT;
-    curT = nextEdge(curT,tt->v,&curE,tt);
-    assert(curT);
-    
-  } while((curE.p1 != tt->e.p1 || curE.p2 != tt->e.p2) && 
-	  (curE.p1 != tt->e.p2 || curE.p2 != tt->e.p1));    
+      /* make a vector dig record */
+      if (0 > Vect_copy_xy_to_pnts (Points, xarray, yarray, n_points))
+	G_fatal_error ("Vect_copy error\n");
+      
+      Vect_write_line (Map,  (unsigned int) type, Points);
+    }
+  }
 }
 
 /* read a raster into a grid */
@@ -347,7 +341,7 @@ GRID* raster2grid(char* gridname, int nrows, int ncols) {
 
 /* read a raster into a tiled grid */
 TILED_GRID* raster2tiledGrid(char* gridname, int nrows, int ncols,
-			     unsigned int TL) {
+			     unsigned int TL, short useNodata) {
 
   printf("raster2grid: reading raster %s..", gridname);
 
@@ -416,6 +410,7 @@ TILED_GRID* raster2tiledGrid(char* gridname, int nrows, int ncols,
      }
     }
   }
+  initTileStats(g,iNumTiles,jNumTiles,useNodata);
  
   CELL c;
   FCELL f;
@@ -424,7 +419,6 @@ TILED_GRID* raster2tiledGrid(char* gridname, int nrows, int ncols,
   int isnull = 0;
   g->min = 9999;
   g->max = 0;
-  int ti,ti1 = -1,tj,tj1 = -1;
 
   for (i = 0; i< nrows; i++) {
     
@@ -476,25 +470,9 @@ TILED_GRID* raster2tiledGrid(char* gridname, int nrows, int ncols,
 	g->min = x;
       if(x > g->max)
 	g->max = x;
-      
-      // Map i,j to tile(s)
-      if(i != 0 && i % (TL-1) == 0) // If on a boundary
-	ti1 = (i-1)/(TL-1);
-      ti = i/(TL-1);
-      if(j != 0 && j % (TL-1) == 0) // If on a boundary
-	tj1 = (j-1)/(TL-1);
-      tj = j/(TL-1);
+
       value = x;
-      writeElevToTile(g->files[ti][tj],(ELEV_TYPE)value);
-      if(ti1 != -1){
-	writeElevToTile(g->files[ti1][tj],(ELEV_TYPE)value);
-	if(tj1 != -1)
-	  writeElevToTile(g->files[ti1][tj1],(ELEV_TYPE)value);
-      }
-      if(tj1 != -1)
-	writeElevToTile(g->files[ti][tj1],(ELEV_TYPE)value);
-      
-      ti1 = tj1 = -1;
+      writeElevToTiles(g,i,j,(ELEV_TYPE)value);
       
     } /* for j */
 
@@ -64,7 +64,7 @@ GRID* raster2grid(char* gridname, int nrows, int ncols);
 
 /* read a raster into a tiled grid */
 TILED_GRID* raster2tiledGrid(char* gridname, int nrows, int ncols,
-			     unsigned int TL);
+			     unsigned int TL, short useNodata);
 
 
 #endif /* __grass_h */
@@ -49,17 +49,159 @@ void writeElevToTile(FILE *fp,ELEV_TYPE z){
 }
 
 
+//
+// Allocate the tile statistics of a tiled grid. The runs of valid
+// cells are only kept if useNodata is 0, when the nodata cells are
+// skipped while reading the tiles
+//
+void initTileStats(TILED_GRID *g, int iNumTiles, int jNumTiles, 
+		   short useNodata){
+  int i,j;
+  
+  g->stats = (TILE_STATS**)malloc(iNumTiles * sizeof(TILE_STATS*));
+  assert(g->stats);
+  for(i=0;i<iNumTiles;i++){
+    g->stats[i] = (TILE_STATS*)malloc(jNumTiles * sizeof(TILE_STATS));
+    assert(g->stats[i]);
+    for(j=0;j<jNumTiles;j++){
+      g->stats[i][j].min = ELEV_TYPE_MAX;
+      g->stats[i][j].max = ELEV_TYPE_MIN;
+      g->stats[i][j].mean = 0;
+      g->stats[i][j].numValid = 0;
+      g->stats[i][j].numNodata = 0;
+      g->stats[i][j].numRuns = 0;
+      g->stats[i][j].maxRuns = 16;
+      g->stats[i][j].runs = NULL;
+      if(!useNodata){
+	g->stats[i][j].runs = (TILE_RUN*)malloc(16 * sizeof(TILE_RUN));
+	assert(g->stats[i][j].runs);
+      }
+    }
+  }
+}
+
+
+//
+// Write the elevation of grid cell (i,j) to tile (ti,tj) and update
+// the statistics and runs of valid cells of the tile
+//
+void writeElevToTileStats(TILED_GRID *g, int ti, int tj, COORD_TYPE i, 
+			  COORD_TYPE j, ELEV_TYPE z){
+  TILE_STATS *s = &g->stats[ti][tj];
+
+  writeElevToTile(g->files[ti][tj],z);
+  if(z == g->nodata){
+    s->numNodata++;
+    return;
+  }
+
+  if(z < s->min)
+    s->min = z;
+  if(z > s->max)
+    s->max = z;
+  s->numValid++;
+  s->mean += (z - s->mean) / s->numValid;
+
+  if(s->runs == NULL)
+    return;
+
+  // Extend the last run or start a new one
+  COORD_TYPE row = i - ti*(g->TL-1);
+  COORD_TYPE col = j - tj*(g->TL-1);
+  TILE_RUN *r;
+  if(s->numRuns > 0){
+    r = &s->runs[s->numRuns-1];
+    if(r->row == row && r->col + r->len == col){
+      r->len++;
+      return;
+    }
+  }
+  if(s->numRuns == s->maxRuns){
+    // Runs only pay off for tiles which are mostly nodata. With more
+    // than one run per 8 cells in the tile the tile is read densely
+    if(s->maxRuns*2 > (g->TL*g->TL)/8){
+      free(s->runs);
+      s->runs = NULL;
+      return;
+    }
+    s->maxRuns *= 2;
+    s->runs = (TILE_RUN*)realloc(s->runs,s->maxRuns * sizeof(TILE_RUN));
+    assert(s->runs);
+  }
+  r = &s->runs[s->numRuns++];
+  r->row = row;
+  r->col = col;
+  r->len = 1;
+}
+
+
+//
+// Write the elevation of grid cell (i,j) to every tile it belongs
+// to and update their statistics. Cells on a tile boundary belong
+// to up to four tiles since tiles overlap by one row and column
+//
+void writeElevToTiles(TILED_GRID *g, COORD_TYPE i, COORD_TYPE j, 
+		      ELEV_TYPE z){
+  unsigned int TL = g->TL;
+  int ti,ti1 = -1,tj,tj1 = -1;
+
+  // Map i,j to tile(s)
+  if(i != 0 && i % (TL-1) == 0) // If on a boundary
+    ti1 = (i-1)/(TL-1);
+  ti = i/(TL-1);
+  if(j != 0 && j % (TL-1) == 0) // If on a boundary
+    tj1 = (j-1)/(TL-1);
+  tj = j/(TL-1);
+
+  writeElevToTileStats(g,ti,tj,i,j,z);
+  if(ti1 != -1){
+    writeElevToTileStats(g,ti1,tj,i,j,z);
+    if(tj1 != -1)
+      writeElevToTileStats(g,ti1,tj1,i,j,z);
+  }
+  if(tj1 != -1)
+    writeElevToTileStats(g,ti,tj1,i,j,z);
+}
+
+
+//
+// Skip n values of an arc-ascii grid file without converting them.
+// Return 0 if the file ends first
+//
+int skipGridValues(FILE *fp, unsigned long n){
+  int c, inValue = 0;
+
+  while(n > 0){
+    if((c = getc_unlocked(fp)) == EOF)
+      return 0;
+    if(c == ' ' || c == '\n' || c == '\r' || c == '\t'){
+      if(inValue)
+	n--;
+      inValue = 0;
+    }
+    else
+      inValue = 1;
+  }
+  return 1;
+}
+
+
 //
 // Read a arc-ascii grid file into a set of tile files. This way we
 // don't read the data into memory but instead seperate it into tile
-// which we can work on one by one
+// which we can work on one by one. If region is not NULL only the
+// window is read and it becomes the grid: its rows before r0 are
+// skipped without being converted, the file is not read past r1, and
+// the corner is moved to the window. useNodata is as in initTileStats
 //
-TILED_GRID *readGrid2Tile(char *path, unsigned int TL){
+TILED_GRID *readGrid2Tile(char *path, unsigned int TL, GRID_REGION *region,
+			  short useNodata){
   FILE *inputf;
   COORD_TYPE i,j;
   long value, resolution; 
   int fd = -1;
   int iNumTiles,jNumTiles;
+  unsigned long skipBefore = 0, skipAfter = 0;
 
 
   // Validate input file
@@ -84,6 +226,30 @@ TILED_GRID *readGrid2Tile(char *path, unsigned int TL){
     exit(1);
   }
   
+  // Skip the rows above the window. The values left and right of the
+  // window are skipped row by row
+  if(region != NULL){
+    if(region->r0 >= region->r1 || region->c0 >= region->c1 ||
+       region->r1 >= g->nrows || region->c1 >= g->ncols){
+      printf("grid: region %lu,%lu,%lu,%lu is not in the %lu x %lu grid\n",
+	     region->r0, region->c0, region->r1, region->c1, 
+	     g->nrows, g->ncols);
+      exit(1);
+    }
+    if(!skipGridValues(inputf,region->r0 * g->ncols)){
+      printf("grid: data file is corrupt");
+      exit(1);
+    }
+    skipBefore = region->c0;
+    skipAfter = g->ncols - 1 - region->c1;
+    g->x += region->c0 * g->cellsize;
+    g->y += (g->nrows - 1 - region->r1) * g->cellsize;
+    g->nrows = region->r1 - region->r0 + 1;
+    g->ncols = region->c1 - region->c0 + 1;
+    printf("region=[%lu, %lu] to [%lu, %lu]\n", region->r0, region->c0,
+	   region->r1, region->c1);
+  }
+
   if(g->nrows > COORD_TYPE_MAX || g->ncols > COORD_TYPE_MAX){
      printf("grid: Too many rows or columns. Change type of COORD.");
      exit(1);
@@ -118,13 +284,16 @@ TILED_GRID *readGrid2Tile(char *path, unsigned int TL){
      }
     }
   }
-
-  int ti,ti1 = -1,tj,tj1 = -1;
+  initTileStats(g,iNumTiles,jNumTiles,useNodata);
 
   // Put data into the files and calculate max & min
   g->min = 9999;
   g->max = 0;
   for(i=0;i<g->nrows;i++){
+    if(!skipGridValues(inputf,skipBefore)){
+      printf("grid: data file is corrupt");
+      exit(1);
+    }
     for(j=0;j<g->ncols;j++){
       if(fscanf(inputf,"%ld",&value)!=EOF){
 	if(value < g->min && value != g->nodata)
@@ -137,31 +306,17 @@ TILED_GRID *readGrid2Tile(char *path, unsigned int TL){
 		 ,value,sizeof(COORD_TYPE));
 	  exit(1);
 	}
-	// Map i,j to tile(s)
-	if(i != 0 && i % (TL-1) == 0) // If on a boundary
-	  ti1 = (i-1)/(TL-1);
-	ti = i/(TL-1);
-	if(j != 0 && j % (TL-1) == 0) // If on a boundary
-	  tj1 = (j-1)/(TL-1);
-	tj = j/(TL-1);
-
-	writeElevToTile(g->files[ti][tj],(ELEV_TYPE)value);
-	if(ti1 != -1){
-	  writeElevToTile(g->files[ti1][tj],(ELEV_TYPE)value);
-	  if(tj1 != -1)
-	    writeElevToTile(g->files[ti1][tj1],(ELEV_TYPE)value);
-	}
-	if(tj1 != -1)
-	  writeElevToTile(g->files[ti][tj1],(ELEV_TYPE)value);
-
-	ti1 = tj1 = -1;
-
+	writeElevToTiles(g,i,j,(ELEV_TYPE)value);
       }
       else{
 	printf("grid: data file is corrupt");
 	exit(1);
       }
     }
+    if(i < g->nrows - 1 && !skipGridValues(inputf,skipAfter)){
+      printf("grid: data file is corrupt");
+      exit(1);
+    }
   }
 
   // Set resolution as a function of gridsize
@@ -56,12 +56,51 @@ typedef struct grid_t {
   ELEV_TYPE min;        // Min elevation
 } GRID;
 
+//
+// A run of valid (not nodata) cells in one row of a tile file
+//
+typedef struct tile_run {
+  COORD_TYPE row;    // row in the tile
+  COORD_TYPE col;    // first column of the run in the tile
+  COORD_TYPE len;    // number of cells in the run
+} TILE_RUN;
+
+//
+// Statistics of the values written to a tile file, gathered while
+// the grid is split into tiles. min and max ignore nodata values
+//
+typedef struct tile_stats {
+  ELEV_TYPE min;             // Min elevation in the tile
+  ELEV_TYPE max;             // Max elevation in the tile
+  double mean;               // Mean elevation in the tile
+  unsigned int numValid;     // Number of valid values in the tile
+  unsigned int numNodata;    // Number of nodata values in the tile
+  // Runs of valid cells in row major order. Runs are only kept while
+  // there are few of them, runs is NULL if the nodata values of the
+  // tile are too scattered
+  TILE_RUN *runs;
+  unsigned int numRuns;
+  unsigned int maxRuns;
+} TILE_STATS;
+
+//
+// Window of a grid, the rows r0 to r1 and the columns c0 to c1, ends
+// included
+//
+typedef struct grid_region {
+  unsigned long r0;
+  unsigned long c0;
+  unsigned long r1;
+  unsigned long c1;
+} GRID_REGION;
+
 //
 // tiled grid structure with file pointers instead of data in memory
 //
 typedef struct tiled_grid {
   char*name;      // File name (path)
   FILE ***files;    // Tiled set of files
+  TILE_STATS **stats;   // Statistics for each tile file
   unsigned long ncols;  // Number of columns
   unsigned long nrows;  // Number of rows
   double x;        // x lat lon corner 
@@ -79,12 +118,45 @@ typedef struct tiled_grid {
 //
 void writeElevToTile(FILE *fp,ELEV_TYPE z);
 
+//
+// Allocate the tile statistics of a tiled grid. The runs of valid
+// cells are only kept if useNodata is 0, when the nodata cells are
+// skipped while reading the tiles
+//
+void initTileStats(TILED_GRID *g, int iNumTiles, int jNumTiles, 
+		   short useNodata);
+
+//
+// Write the elevation of grid cell (i,j) to tile (ti,tj) and update
+// the statistics and runs of valid cells of the tile
+//
+void writeElevToTileStats(TILED_GRID *g, int ti, int tj, COORD_TYPE i, 
+			  COORD_TYPE j, ELEV_TYPE z);
+
+//
+// Write the elevation of grid cell (i,j) to every tile it belongs
+// to and update their statistics. Cells on a tile boundary belong
+// to up to four tiles since tiles overlap by one row and column
+//
+void writeElevToTiles(TILED_GRID *g, COORD_TYPE i, COORD_TYPE j, 
+		      ELEV_TYPE z);
+
+//
+// Skip n values of an arc-ascii grid file without converting them.
+// Return 0 if the file ends first
+//
+int skipGridValues(FILE *fp, unsigned long n);
+
 //
 // Read a arc-ascii grid file into a set of tile files. This way we
 // don't read the data into memory but instead seperate it into tile
-// which we can work on one by one
+// which we can work on one by one. If region is not NULL only the
+// window is read and it becomes the grid: its rows before r0 are
+// skipped without being converted, the file is not read past r1, and
+// the corner is moved to the window. useNodata is as in initTileStats
 //
-TILED_GRID *readGrid2Tile(char *path, unsigned int TL);
+TILED_GRID *readGrid2Tile(char *path, unsigned int TL, GRID_REGION *region,
+			  short useNodata);
 
 //
 // bring grid file into an array
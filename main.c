@@ -43,6 +43,9 @@
 #include "rtimer.h"
 #include "refine_tin.h"
 #include "render_tin.h" 
+#include "stats.h"
+#include "mem_manager.h"
+#include "trace.h"
 
 #ifdef __GRASS__
 #include "grass.h"
@@ -51,6 +54,22 @@
 // global tin needed for rendering in OpenGL 
 extern TIN *tinGlobal;
 
+// JSON file for the run statistics, NULL for none
+char *statsFile = NULL;
+
+// Chrome trace file of the run, NULL for none
+char *traceFile = NULL;
+
+// CSV file for the convergence curve, NULL for none
+char *curveFile = NULL;
+
+#ifndef __GRASS__
+// Window of the grid to refine, NULL for the whole grid. Under GRASS
+// the current region is the window
+GRID_REGION gridRegion;
+GRID_REGION *regionOpt = NULL;
+#endif
+
 // parse arguments from the user 
 void parse_args(int argc, char *argv[],double *err,double *mem,
 		int *useNoData, int *delaunay, int *render,
@@ -116,13 +135,20 @@ int main(int argc, char** argv) {
   parse_args(argc,argv,&err,&mem,&useNoData,&delaunay,&doRender,&outputFile,
 	     &inputFile,&outputSites, &outputVect);
 
+  if(traceFile != NULL)
+    traceOpen(traceFile);
+
   // import from grid if we have an inputFile 
   if(inputFile != NULL){
+    TRACE_BEGIN("ingest");
 #ifdef __GRASS__
-    gridFile = raster2tiledGrid(inputFile,nr,nc,getTileLength(mem));
+    gridFile = raster2tiledGrid(inputFile,nr,nc,getTileLength(mem),
+				useNoData);
 #else
-    gridFile = readGrid2Tile(inputFile,getTileLength(mem));
+    gridFile = readGrid2Tile(inputFile,getTileLength(mem),regionOpt,
+			     useNoData);
 #endif
+    TRACE_END("ingest");
   }
 
   // start total timer 
@@ -131,7 +157,9 @@ int main(int argc, char** argv) {
   // initialize a tin if we have a grid 
   if(gridFile != NULL){
     doRefine = 1;
+    TRACE_BEGIN("initTin");
     tinGlobal = initTin(gridFile, err, mem,useNoData,outputFile);
+    TRACE_END("initTin");
   }
 
   // if we just initialized the tin then we will refine it 
@@ -142,6 +170,9 @@ int main(int argc, char** argv) {
     // make err a percentage of the max and min elevations 
     errAmt = ((double)(tinGlobal->max - tinGlobal->min)) * (err/100.0);
 
+    if(curveFile != NULL)
+      initCurve();
+
     // refine the tin 
     refineTin(errAmt,delaunay,tinGlobal,outputFile,outputSites,outputVect,useNoData);
     
@@ -161,8 +192,30 @@ int main(int argc, char** argv) {
     printf("TIN: triangles=%ld points=%ld\n", 
 	   (long)tinGlobal->numTris, 
 	   (long)tinGlobal->numPoints);
+    printf("point moves=%lu edge swaps=%lu swap moves=%lu lazy=%d\n",
+	   refineStats.pointMoves, refineStats.edgeSwaps,
+	   refineStats.swapPointMoves, refineOpts.lazySwap);
     printf("total time: %s\n", buf1);
+#ifndef NO_STATS
+    if(memTracking){
+      memPrint();
+      if(memUsage.totalPeak > mem * 1048576)
+	printf("warning: tracked memory peaked at %.2fMB, above "
+	       "mem=%.2fMB\n", memUsage.totalPeak / 1048576.0, mem);
+    }
+#endif
+
+    if(statsFile != NULL){
+      char *phaseNames[2] = {"total", "refine"};
+      Rtimer phases[2];
+      phases[0] = totalTime;
+      phases[1] = refineTime;
+      statsWrite(statsFile,tinGlobal,err,phaseNames,phases,2);
+    }
+    if(curveFile != NULL)
+      writeCurve(curveFile,tinGlobal,errAmt);
   }
+  traceClose();
   
   // if user wants to render then we pass control to OpenGL. Once
   // control is passed there is no way to execute further code so this
@@ -246,6 +299,71 @@ void parse_args(int argc, char *argv[],double *err,double *mem,
   memory->answer      = "500"; // 300MB default value 
   memory->description = "Main memory size (in MB)";
 
+  // seed lattice spacing
+  struct Option *seed;
+  seed = G_define_option() ;
+  seed->key         = "seed";
+  seed->type        = TYPE_INTEGER;
+  seed->required    = NO;
+  seed->answer      = "0"; // no seeding by default
+  seed->description = "Spacing of the seed lattice inserted before "
+    "refinement (0 for none)";
+
+  // threads for the distribution of large point lists
+  struct Option *threads;
+  threads = G_define_option() ;
+  threads->key         = "threads";
+  threads->type        = TYPE_INTEGER;
+  threads->required    = NO;
+  threads->answer      = "1";
+  threads->description = "Threads used to distribute large point lists";
+
+  // triangles refined per round
+  struct Option *batch;
+  batch = G_define_option() ;
+  batch->key         = "batch";
+  batch->type        = TYPE_INTEGER;
+  batch->required    = NO;
+  batch->answer      = "1"; // greedy refinement by default
+  batch->description = "Max number of independent triangles refined "
+    "per round";
+
+  // run statistics
+  struct Option *stats;
+  stats = G_define_option() ;
+  stats->key         = "stats";
+  stats->type        = TYPE_STRING;
+  stats->required    = NO;
+  stats->answer      = "NULL";
+  stats->description = "JSON file for the run statistics";
+
+  // timeline of the run
+  struct Option *trace;
+  trace = G_define_option() ;
+  trace->key         = "trace";
+  trace->type        = TYPE_STRING;
+  trace->required    = NO;
+  trace->answer      = "NULL";
+  trace->description = "Chrome trace file of the run phases";
+
+  // convergence curve
+  struct Option *curve;
+  curve = G_define_option() ;
+  curve->key         = "curve";
+  curve->type        = TYPE_STRING;
+  curve->required    = NO;
+  curve->answer      = "NULL";
+  curve->description = "CSV file for the number of points at each error";
+
+  // progress reports
+  struct Option *prog;
+  prog = G_define_option() ;
+  prog->key         = "progress";
+  prog->type        = TYPE_DOUBLE;
+  prog->required    = NO;
+  prog->answer      = "0"; // no reports by default
+  prog->description = "Seconds between progress reports (0 for none)";
+
   // Use Delaunay ? 
   struct Flag *del;
   del = G_define_flag() ;
@@ -264,6 +382,13 @@ void parse_args(int argc, char *argv[],double *err,double *mem,
   render_tin->key        = 'r';
   render_tin->description= "Render TIN in OpenGL" ;
 
+  // Lazy edge swaps?
+  struct Flag *lazy;
+  lazy = G_define_flag() ;
+  lazy->key        = 'l';
+  lazy->description= "Redistribute points once per Delaunay cascade "
+    "instead of on every edge swap" ;
+
 
 
   if (G_parser(argc, argv)) {
@@ -292,6 +417,33 @@ void parse_args(int argc, char *argv[],double *err,double *mem,
   //default is 0
   if (render_tin->answer) *render = 1;
 
+  //default is 0
+  if (lazy->answer) refineOpts.lazySwap = 1;
+
+  //default is 0
+  refineOpts.seedSpacing = atoi(seed->answer);
+
+  //default is 1
+  refineOpts.distrThreads = atoi(threads->answer);
+
+  //default is 1
+  refineOpts.batchSize = atoi(batch->answer);
+
+  //default is 0
+  refineOpts.progressInterval = atof(prog->answer);
+
+  if (strcmp("NULL", stats->answer) != 0) {
+    statsFile = stats->answer;
+    statsTiming = 1;
+    memTracking = 1;
+  }
+
+  if (strcmp("NULL", trace->answer) != 0) 
+    traceFile = trace->answer;
+
+  if (strcmp("NULL", curve->answer) != 0) 
+    curveFile = curve->answer;
+
   printf("%s grid=%s output=%s output-sites=%s outputVect=%s "
 	 "error=%.2f mem=%.2f delaunay=%d no_data=%d render=%d\n",
 	 argv[0], *inputFile, *outputFile, *outputSites, *outputVect,
@@ -300,11 +452,66 @@ void parse_args(int argc, char *argv[],double *err,double *mem,
 
 #else
 
+//
+// Parse a key=value option given after the positional arguments
+//
+void parse_option(char *arg){
+  char *value = strchr(arg,'=') + 1;
+  
+  if(strncmp(arg,"lazy=",5)==0)
+    refineOpts.lazySwap = atoi(value);
+  else if(strncmp(arg,"seed=",5)==0)
+    refineOpts.seedSpacing = atoi(value);
+  else if(strncmp(arg,"threads=",8)==0)
+    refineOpts.distrThreads = atoi(value);
+  else if(strncmp(arg,"batch=",6)==0)
+    refineOpts.batchSize = atoi(value);
+  else if(strncmp(arg,"stats=",6)==0){
+    statsFile = value;
+    statsTiming = 1;
+    memTracking = 1;
+  }
+  else if(strncmp(arg,"trace=",6)==0)
+    traceFile = value;
+  else if(strncmp(arg,"curve=",6)==0)
+    curveFile = value;
+  else if(strncmp(arg,"progress=",9)==0)
+    refineOpts.progressInterval = atof(value);
+  else if(strncmp(arg,"region=",7)==0){
+    if(sscanf(value,"%lu,%lu,%lu,%lu",&gridRegion.r0,&gridRegion.c0,
+	      &gridRegion.r1,&gridRegion.c1) != 4){
+      printf("region must be r0,c0,r1,c1: %s\n",arg);
+      exit(1);
+    }
+    regionOpt = &gridRegion;
+  }
+  else{
+    printf("unknown option: %s\n",arg);
+    exit(1);
+  }
+}
+
+
 void parse_args(int argc, char *argv[],double *err,double *mem,
 		int *useNoData, int *delaunay, int *render,
 		char **outputFile, char **inputFile,
 		char **outputSites, char **outputVect){
 
+  // key=value options can be given anywhere, take them out so the
+  // positional arguments are parsed as before
+  int i, n = 1;
+  char **args = (char**)malloc(argc * sizeof(char*));
+  assert(args);
+  args[0] = argv[0];
+  for(i = 1; i < argc; i++){
+    if(strchr(argv[i],'=') != NULL)
+      parse_option(argv[i]);
+    else
+      args[n++] = argv[i];
+  }
+  argc = n;
+  argv = args;
+
   // check for an import... if so we just display tin 
   if (argc >= 3 && strcmp(argv[2],"import")==0){
     
@@ -322,8 +529,21 @@ void parse_args(int argc, char *argv[],double *err,double *mem,
   // validate the number of arguments 
   else if (argc < 4){
     printf("usage: r.refine <intput-grid> <output-tin> <error> [memory in MB]" 
-	   "[delaunay] [nodata] [render]\n");
+	   "[delaunay] [nodata] [render] [option=value ...]\n");
     printf("       tin <input-tin> import [render]\n"); 
+    printf("options:\n");
+    printf("  lazy=0|1    redistribute points once per Delaunay cascade\n");
+    printf("  seed=N      insert a seed lattice of spacing N first\n");
+    printf("  threads=N   distribute large point lists with N threads\n");
+    printf("  batch=K     refine up to K independent triangles per round\n");
+    printf("  stats=FILE  write the run statistics to a JSON file\n");
+    printf("  trace=FILE  write a timeline of the run phases in the "
+	   "Chrome trace format\n");
+    printf("  curve=FILE  write the number of points at each error above "
+	   "<error> to a CSV file\n");
+    printf("  progress=S  report the progress to stderr every S seconds\n");
+    printf("  region=r0,c0,r1,c1  refine only the rows r0 to r1 and the "
+	   "columns c0 to c1\n");
     exit(1);
   }
 
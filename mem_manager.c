@@ -23,25 +23,122 @@
  *
  * UPDATED:   jt 2005-08-15
  *
- * COMMENTS: This code is mostly for debug purposes and is not
- * currently being used
+ * COMMENTS: The counters are updated atomically as the point lists
+ * are also built by worker threads, and only when memTracking is
+ * set so that the runs without stats= do not pay for the atomics.
  *
  *****************************************************************************/
 
+#include <assert.h>
 #include "mem_manager.h"
 
-unsigned int memUsage = 0;
+MEM_USAGE memUsage;
 
-void *myMalloc(size_t size,char *str){
-  if(str != NULL)
-    printf("myMalloc: %s \n",str);
-  memUsage += size;
-  return malloc(size);
+// Count the memory, set before the first allocation
+short memTracking = 0;
+
+// High-water mark of the total in the current tile
+static long memTileMax = 0;
+
+// Names of the categories
+char *memNames[MEM_NUM] = {
+  "triangles", "queues", "pq", "points", "buffers"
+};
+
+
+#ifndef NO_STATS
+
+//
+// Raise the high-water mark *peak to value. Another thread may raise
+// it at the same time, so retry until value is no longer above it
+//
+static void memMax(long *peak, long value){
+  long old;
+
+  while(value > (old = __atomic_load_n(peak, __ATOMIC_RELAXED)) &&
+	!__sync_bool_compare_and_swap(peak, old, value))
+    ;
+}
+
+
+//
+// Add delta bytes to category cat and update the high-water marks
+//
+static void memCount(int cat, long delta){
+  long cur, total;
+
+  cur = __sync_add_and_fetch(&memUsage.current[cat], delta);
+  total = __sync_add_and_fetch(&memUsage.total, delta);
+  if(delta > 0){
+    memMax(&memUsage.peak[cat], cur);
+    memMax(&memUsage.totalPeak, total);
+    memMax(&memTileMax, total);
+  }
 }
 
-void myFree(void *ptr, char *str){
-  if(str != NULL)
-    printf("myFree: %s \n",str);
-  memUsage -= sizeof(ptr);
+
+//
+// malloc size bytes counted in category cat
+//
+void *memAlloc(int cat, size_t size){
+  void *ptr = malloc(size);
+  if(ptr != NULL && memTracking)
+    memCount(cat, size);
+  return ptr;
+}
+
+
+//
+// realloc ptr, a block of oldSize bytes of category cat, to size bytes
+//
+void *memRealloc(int cat, void *ptr, size_t oldSize, size_t size){
+  void *p = realloc(ptr, size);
+  if(p != NULL && memTracking)
+    memCount(cat, (long)size - (long)(ptr != NULL ? oldSize : 0));
+  return p;
+}
+
+
+//
+// free ptr, a block of size bytes of category cat
+//
+void memFree(int cat, void *ptr, size_t size){
+  if(ptr == NULL)
+    return;
+  if(memTracking)
+    memCount(cat, -(long)size);
   free(ptr);
 }
+
+#endif
+
+
+//
+// Start the high-water mark of a tile at the memory in use
+//
+void memBeginTile(){
+  memTileMax = memUsage.total;
+}
+
+
+//
+// High-water mark of the total since memBeginTile
+//
+long memTilePeak(){
+  return memTileMax;
+}
+
+
+//
+// Print the memory in use and the high-water marks
+//
+void memPrint(){
+#ifndef NO_STATS
+  int i;
+  printf("memory peak=%.2fMB in use=%.2fMB\n",
+	 memUsage.totalPeak / 1048576.0, memUsage.total / 1048576.0);
+  for(i = 0; i < MEM_NUM; i++)
+    printf("  %-10s peak=%.2fMB in use=%.2fMB\n", memNames[i],
+	   memUsage.peak[i] / 1048576.0, memUsage.current[i] / 1048576.0);
+#endif
+}
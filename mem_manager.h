@@ -23,8 +23,11 @@
  *
  * UPDATED:   jt 2005-08-15
  *
- * COMMENTS: This code is mostly for debug purposes and is not
- * currently being used
+ * COMMENTS: The main structures of the refinement are allocated with
+ * memAlloc, memRealloc and memFree, which count the bytes in use and
+ * the high-water mark of each category. The caller gives the size of
+ * the block being freed. Compiling with -DNO_STATS turns them into
+ * malloc, realloc and free.
  *
  *****************************************************************************/
 
@@ -34,7 +37,72 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-void *myMalloc(size_t size,char *str);
-void myFree(void *ptr,char *str);
+//
+// Categories of tracked memory
+//
+enum {
+  MEM_TRI,      // triangle arenas
+  MEM_QUEUE,    // point list nodes and heads
+  MEM_PQ,       // priority queues
+  MEM_POINTS,   // tile vertices and point arrays
+  MEM_BUF,      // tile read buffers and seed arrays
+  MEM_NUM
+};
+
+//
+// Bytes in use and high-water mark of each category and of their
+// total. These are the sizes requested, without malloc overhead
+//
+typedef struct Mem_Usage {
+  long current[MEM_NUM];
+  long peak[MEM_NUM];
+  long total;
+  long totalPeak;
+} MEM_USAGE;
+
+extern MEM_USAGE memUsage;
+
+// Count the memory, set before the first allocation. Set with stats=
+extern short memTracking;
+
+// Names of the categories
+extern char *memNames[MEM_NUM];
+
+#ifdef NO_STATS
+#define memAlloc(cat,size) malloc(size)
+#define memRealloc(cat,ptr,oldSize,size) realloc(ptr,size)
+#define memFree(cat,ptr,size) free(ptr)
+#else
+
+//
+// malloc size bytes counted in category cat
+//
+void *memAlloc(int cat, size_t size);
+
+//
+// realloc ptr, a block of oldSize bytes of category cat, to size bytes
+//
+void *memRealloc(int cat, void *ptr, size_t oldSize, size_t size);
+
+//
+// free ptr, a block of size bytes of category cat
+//
+void memFree(int cat, void *ptr, size_t size);
+#endif
+
+//
+// Start the high-water mark of a tile at the memory in use
+//
+void memBeginTile();
+
+//
+// High-water mark of the total since memBeginTile
+//
+long memTilePeak();
+
+//
+// Print the memory in use and the high-water marks
+//
+void memPrint();
 
 #endif
@@ -34,12 +34,16 @@
 
 
 //
-// determine the priority of an element
+// determine the priority of an element. Equal errors are ordered by
+// the max error point, smaller (x,y) first
 //
 double getPriority(PQ_elemType t) {
-  assert(t);
+  assert(t && t->maxE);
   //return -error;
-  return -t->maxErrorValue;
+  // The order the triangles leave the PQ then does not depend on the
+  // order they were inserted. x*2^15+y < 2^30 is exact in the fraction
+  return -t->maxErrorValue + 
+    ((double)t->maxE->x * 32768 + t->maxE->y) / 1073741824.0;
 } 
 
 //
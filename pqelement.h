@@ -41,7 +41,8 @@
 typedef TRIANGLE* PQ_elemType; 
 
 //
-// determine the priority of an element
+// determine the priority of an element. Equal errors are ordered by
+// the max error point, smaller (x,y) first
 //
 double getPriority(PQ_elemType t);
 
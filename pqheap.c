@@ -32,6 +32,8 @@
 #include <stdlib.h>
 
 #include "pqheap.h"
+#include "stats.h"
+#include "mem_manager.h"
 
 // setting this enables printing pq debug info 
 #define PQ_DEBUG if(0)
@@ -132,7 +134,8 @@ static void PQ_grow(PQueue* pq) {
   
   assert(pq && pq->elements);
   pq->maxsize *= 2; 
-  elements = (PQ_elemType*)malloc(pq->maxsize*sizeof(PQ_elemType));
+  elements = (PQ_elemType*)memAlloc(MEM_PQ, 
+				    pq->maxsize*sizeof(PQ_elemType));
   if (!elements) {
     printf("PQ_grow: could not reallocate priority queue: insufficient memory..\n");
     exit(1);
@@ -143,7 +146,7 @@ static void PQ_grow(PQueue* pq) {
     //Update triangle
     elements[i]->pqIndex = i;
   }
-  free(pq->elements);
+  memFree(MEM_PQ, pq->elements, pq->maxsize/2*sizeof(PQ_elemType));
   pq->elements = elements;
 }
 
@@ -154,13 +157,17 @@ static void PQ_grow(PQueue* pq) {
 PQueue* PQ_initialize(unsigned int initSize) {
   PQueue *pq; 
 
-  initSize = PQINITSIZE;
+  // Small tiles get a PQ of their size, the PQ grows as needed
+  assert(initSize > 0);
+  if(initSize > PQINITSIZE)
+    initSize = PQINITSIZE;
 
   PQ_DEBUG{printf("PQ-initialize: initializing heap with %ud elements\n",
 		  initSize); fflush(stdout);}
-  pq = (PQueue*)malloc(sizeof(PQueue));
+  pq = (PQueue*)memAlloc(MEM_PQ, sizeof(PQueue));
   assert(pq);
-  pq->elements = (PQ_elemType*)malloc(initSize*sizeof(PQ_elemType));
+  pq->elements = (PQ_elemType*)memAlloc(MEM_PQ, 
+					initSize*sizeof(PQ_elemType));
   if (!pq->elements) {
     printf("PQ_initialize: could not allocate priority queue: insufficient memory..\n");
     exit(1);
@@ -179,7 +186,8 @@ void PQ_free(PQueue* pq) {
 
   PQ_DEBUG{printf("PQ-delete: deleting heap\n"); fflush(stdout);}
   assert(pq && pq->elements); 
-  if (pq->elements) free(pq->elements);
+  memFree(MEM_PQ, pq->elements, pq->maxsize*sizeof(PQ_elemType));
+  memFree(MEM_PQ, pq, sizeof(PQueue));
 }
  
 //
@@ -221,6 +229,7 @@ int PQ_min(PQueue* pq, PQ_elemType* elt) {
 int PQ_extractMin(PQueue* pq, PQ_elemType* elt) {
 
   assert(pq && pq->elements);
+  STATS_COUNT(STAT_PQ_EXTRACT);
   if (!pq->cursize) {
     return 0;
   }
@@ -256,6 +265,7 @@ void PQ_insert(PQueue* pq, PQ_elemType elt) {
   unsigned int ii;
   assert(pq && pq->elements); 
   assert(elt->maxE != DONE);
+  STATS_COUNT(STAT_PQ_INSERT);
  
   PQ_DEBUG {printf("PQ_insert: "); printElem(elt); printf("\n"); fflush(stdout);}
   if (pq->cursize==pq->maxsize) {
@@ -296,12 +306,27 @@ void PQ_deleteMinAndInsert(PQueue* pq, PQ_elemType elt) {
 int PQ_delete(PQueue* pq,unsigned int index){
 
   assert(pq && pq->elements);
+  STATS_COUNT(STAT_PQ_DELETE);
   if (!pq->cursize || index >= pq->cursize) {
     return 0;
   }
 
   // Put the last element in the place of the deleted element
-  pq->elements[index] = pq->elements[--pq->cursize];
+  PQ_elemType elt = pq->elements[--pq->cursize];
+  if (index == pq->cursize) {
+    return 1;
+  }
+
+  // It may have to go up as well as down from there
+  for (;
+       index && (getPriority(pq->elements[heap_parent(index)]) > 
+		 getPriority(elt));
+       index = heap_parent(index)) {
+    pq->elements[index] = pq->elements[heap_parent(index)];
+    //Update triangle
+    pq->elements[index]->pqIndex = index;
+  }
+  pq->elements[index] = elt;
   //Update triangle
   pq->elements[index]->pqIndex = index;
   heapify(pq, index);
@@ -28,6 +28,8 @@
  *****************************************************************************/
 
 #include "qsort.h"
+#include <stdlib.h>
+#include <string.h>
 
 //
 // comare point a and b to determine order, sort first by x then by y
@@ -49,3 +51,52 @@ int QS_compPoints(R_POINT **p1, R_POINT **p2){
     }
   }
 }  
+
+
+//
+// Sort an array of n points by x then y with a two pass LSD radix
+// sort: a counting sort on y followed by a stable counting sort on
+// x. All points must have x in [x0,x0+nx) and y in [y0,y0+ny)
+//
+void QS_radixPoints(R_POINT **a, unsigned int n, COORD_TYPE x0, 
+		    COORD_TYPE y0, unsigned int nx, unsigned int ny){
+  unsigned int i, sum, c;
+  unsigned int *count;
+  R_POINT **tmp;
+
+  if(n < 2)
+    return;
+  count = (unsigned int*)malloc(((nx > ny ? nx : ny) + 1) * 
+				sizeof(unsigned int));
+  tmp = (R_POINT**)malloc(n * sizeof(R_POINT*));
+  assert(count && tmp);
+
+  // Pass 1: y, from a to tmp
+  memset(count, 0, (ny + 1) * sizeof(unsigned int));
+  for(i = 0; i < n; i++){
+    assert(a[i]->y - y0 >= 0 && a[i]->y - y0 < ny);
+    count[a[i]->y - y0 + 1]++;
+  }
+  for(c = 0, sum = 0; c <= ny; c++){
+    sum += count[c];
+    count[c] = sum;
+  }
+  for(i = 0; i < n; i++)
+    tmp[count[a[i]->y - y0]++] = a[i];
+
+  // Pass 2: x, from tmp back to a
+  memset(count, 0, (nx + 1) * sizeof(unsigned int));
+  for(i = 0; i < n; i++){
+    assert(tmp[i]->x - x0 >= 0 && tmp[i]->x - x0 < nx);
+    count[tmp[i]->x - x0 + 1]++;
+  }
+  for(c = 0, sum = 0; c <= nx; c++){
+    sum += count[c];
+    count[c] = sum;
+  }
+  for(i = 0; i < n; i++)
+    a[count[tmp[i]->x - x0]++] = tmp[i];
+
+  free(tmp);
+  free(count);
+}
@@ -38,5 +38,13 @@
 // comare point a and b to determine order, sort first by x then by y
 //
 int QS_compPoints( R_POINT **a, R_POINT **b);
+
+//
+// Sort an array of n points by x then y with a two pass LSD radix
+// sort: a counting sort on y followed by a stable counting sort on
+// x. All points must have x in [x0,x0+nx) and y in [y0,y0+ny)
+//
+void QS_radixPoints(R_POINT **a, unsigned int n, COORD_TYPE x0, 
+		    COORD_TYPE y0, unsigned int nx, unsigned int ny);
 	     
 #endif // QSORT_H
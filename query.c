@@ -0,0 +1,672 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * query.c answers batches of elevation queries on a TIN read with
+ * readTinFile
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "query.h"
+
+//
+// Queries answered by one thread
+//
+typedef struct query_chunk {
+  TIN_INDEX *ix;
+  long *order;              // queries sorted by bucket
+  long from;
+  long to;
+  double *x;
+  double *y;
+  double *z;
+  double *x1;               // far ends of the sight lines
+  double *y1;
+  double h0;                // heights of the observer and the target
+  double h1;
+  signed char *visible;
+  unsigned long steps;
+  unsigned long fallbacks;
+} QUERY_CHUNK;
+
+
+//
+// Twice the signed area of a,b,(x,y), positive if (x,y) is off to the
+// left of ab
+//
+static inline double orient(R_POINT *a, R_POINT *b, double x, double y){
+  return (double)(b->x - a->x) * (y - a->y) - 
+    (double)(b->y - a->y) * (x - a->x);
+}
+
+
+//
+// Is (x,y) in t or on its boundary?
+//
+static int inTri(TRIANGLE *t, double x, double y){
+  double o = orient(t->p1,t->p2,t->p3->x,t->p3->y);
+  return orient(t->p1,t->p2,x,y) * o >= 0 &&
+    orient(t->p2,t->p3,x,y) * o >= 0 &&
+    orient(t->p3,t->p1,x,y) * o >= 0;
+}
+
+
+//
+// Walk from t to the triangle holding (x,y), crossing the edge with
+// (x,y) on its outer side. The first edge tried turns with each step,
+// which breaks the cycles a walk can fall into in a triangulation that
+// is not Delaunay. Return NULL if the walk leaves the tile or takes
+// more than maxSteps
+//
+static TRIANGLE *walkTri(TRIANGLE *t, double x, double y,
+			 unsigned int maxSteps, unsigned long *steps){
+  unsigned int s;
+  int k, e;
+
+  for(s = 0; s < maxSteps; s++){
+    R_POINT *p[3] = {t->p1, t->p2, t->p3};
+    TRIANGLE *nbr[3] = {t->p1p2, t->p2p3, t->p1p3};
+    double o = orient(t->p1,t->p2,t->p3->x,t->p3->y);
+    TRIANGLE *next = NULL;
+
+    for(k = 0; k < 3 && next == NULL; k++){
+      e = (k + s) % 3;
+      if(orient(p[e],p[(e+1)%3],x,y) * o < 0){
+	if(nbr[e] == NULL)
+	  return NULL;
+	next = nbr[e];
+      }
+    }
+    if(next == NULL)
+      return t;
+    t = next;
+    (*steps)++;
+  }
+  return NULL;
+}
+
+
+//
+// Find the triangle of tile tt holding (x,y) by looking at all of
+// them, when the walk fails
+//
+static TRIANGLE *scanTri(TIN_TILE *tt, double x, double y){
+  unsigned int pos = 0;
+  TRIANGLE *t;
+
+  while((t = nextTri(&tt->tris,&pos)) != NULL)
+    if(inTri(t,x,y))
+      return t;
+  return NULL;
+}
+
+
+//
+// Locator of tile (i,j), NULL if the tile is not in the TIN
+//
+static TILE_INDEX *tileAt(TIN_INDEX *ix, int i, int j){
+  return ix->tiles[i*ix->jNumTiles + j].tt ? 
+    &ix->tiles[i*ix->jNumTiles + j] : NULL;
+}
+
+
+//
+// Row and column *i,*j of the tile of (x,y). Return 0 if (x,y) is off
+// the grid
+//
+static int findTile(TIN_INDEX *ix, double x, double y, int *i, int *j){
+  unsigned int side = ix->tin->tl - 1;
+
+  if(!(x >= 0 && y >= 0 && x <= ix->tin->nrows-1 && y <= ix->tin->ncols-1))
+    return 0;
+  *i = MIN((int)(x / side), ix->iNumTiles - 1);
+  *j = MIN((int)(y / side), ix->jNumTiles - 1);
+  return 1;
+}
+
+
+//
+// Bucket of tile ti holding (x,y), counted in the tile
+//
+static unsigned int bucketInTile(TILE_INDEX *ti, double x, double y){
+  double r = MAX(0, (x - ti->tt->iOffset) / ti->bucketSide);
+  double c = MAX(0, (y - ti->tt->jOffset) / ti->bucketSide);
+  return MIN((unsigned int)r, ti->rows - 1) * ti->cols + 
+    MIN((unsigned int)c, ti->cols - 1);
+}
+
+
+//
+// Tile and bucket of (x,y). Return the number of the bucket in the
+// TIN, or numBuckets if (x,y) is off the grid or in a tile which is
+// not in the TIN
+//
+static unsigned int findBucket(TIN_INDEX *ix, double x, double y,
+			       TILE_INDEX **tile){
+  int i, j;
+
+  if(!findTile(ix,x,y,&i,&j) || (*tile = tileAt(ix,i,j)) == NULL)
+    return ix->numBuckets;
+  return (*tile)->base + bucketInTile(*tile,x,y);
+}
+
+
+//
+// Triangle of tile ti holding (x,y), by a walk from the start of its
+// bucket or when the walk fails by a scan of the tile
+//
+static TRIANGLE *locateInTile(TILE_INDEX *ti, double x, double y,
+			      unsigned long *steps, unsigned long *fallbacks){
+  TRIANGLE *t = walkTri(ti->start[bucketInTile(ti,x,y)],x,y,
+			ti->tt->numTris + 3,steps);
+  if(t == NULL){
+    (*fallbacks)++;
+    t = scanTri(ti->tt,x,y);
+  }
+  return t;
+}
+
+
+//
+// Height of the plane of triangle t of tile tt at (x,y), or the nodata
+// value if t has a nodata corner
+//
+static double planeZ(TIN_TILE *tt, TRIANGLE *t, double x, double y){
+  R_POINT *p1 = t->p1, *p2 = t->p2, *p3 = t->p3;
+  double d, l2, l3;
+
+  if(p1->z == tt->nodata || p2->z == tt->nodata || p3->z == tt->nodata ||
+     p1->z == tt->nodataZ || p2->z == tt->nodataZ || p3->z == tt->nodataZ)
+    return tt->nodata;
+
+  // Barycentric coordinates of (x,y)
+  d = (double)(p2->x - p1->x) * (p3->y - p1->y) -
+    (double)(p3->x - p1->x) * (p2->y - p1->y);
+  l2 = ((x - p1->x) * (p3->y - p1->y) - (p3->x - p1->x) * (y - p1->y)) / d;
+  l3 = ((p2->x - p1->x) * (y - p1->y) - (x - p1->x) * (p2->y - p1->y)) / d;
+  return p1->z + l2 * (p2->z - p1->z) + l3 * (p3->z - p1->z);
+}
+
+
+//
+// Set the start triangles of the buckets of a tile, each found by a
+// walk from the start of the previous bucket
+//
+static void buildTileIndex(TILE_INDEX *ti, unsigned long *steps){
+  TIN_TILE *tt = ti->tt;
+  double area = (double)(tt->nrows - 1) * (tt->ncols - 1);
+  double buckets = MAX(1.0, (double)tt->numTris / QUERY_TRIS_PER_BUCKET);
+  TRIANGLE *t = tt->t;
+  unsigned int r, c;
+
+  ti->bucketSide = MAX(1.0, sqrt(area / buckets));
+  ti->rows = MAX(1, (unsigned int)ceil((tt->nrows - 1) / ti->bucketSide));
+  ti->cols = MAX(1, (unsigned int)ceil((tt->ncols - 1) / ti->bucketSide));
+  ti->start = (TRIANGLE**)malloc((long)ti->rows * ti->cols *
+				 sizeof(TRIANGLE*));
+  assert(ti->start);
+
+  for(r = 0; r < ti->rows; r++){
+    double x = MIN(tt->iOffset + (r + 0.5) * ti->bucketSide,
+		   tt->iOffset + tt->nrows - 1);
+    for(c = 0; c < ti->cols; c++){
+      double y = MIN(tt->jOffset + (c + 0.5) * ti->bucketSide,
+		     tt->jOffset + tt->ncols - 1);
+      TRIANGLE *s = walkTri(t,x,y,tt->numTris + 3,steps);
+      if(s == NULL)
+	s = scanTri(tt,x,y);
+      assert(s);
+      ti->start[r * ti->cols + c] = t = s;
+    }
+  }
+}
+
+
+//
+// Build the locator of a TIN read with readTinFile
+//
+TIN_INDEX *buildTinIndex(TIN *tin){
+  TIN_INDEX *ix = (TIN_INDEX*)malloc(sizeof(TIN_INDEX));
+  unsigned int side = tin->tl - 1;
+  TIN_TILE *tt;
+  int i, j;
+  assert(ix);
+
+  ix->tin = tin;
+  ix->iNumTiles = ceil(((double)tin->nrows) / ((double)side));
+  ix->jNumTiles = ceil(((double)tin->ncols) / ((double)side));
+  ix->tiles = (TILE_INDEX*)calloc(ix->iNumTiles * ix->jNumTiles,
+				  sizeof(TILE_INDEX));
+  assert(ix->tiles);
+  ix->walkSteps = 0;
+  ix->fallbacks = 0;
+
+  // The list has a dummy head and tail
+  for(tt = tin->tt->next; tt->next != NULL; tt = tt->next){
+    assert(tt->iOffset % side == 0 && tt->jOffset % side == 0);
+    ix->tiles[(tt->iOffset/side) * ix->jNumTiles + tt->jOffset/side].tt = tt;
+  }
+
+  // readNextTile does not link the tiles, a link is NULL if the
+  // neighbor is not in the TIN
+  for(i = 0; i < ix->iNumTiles; i++)
+    for(j = 0; j < ix->jNumTiles; j++){
+      if((tt = ix->tiles[i*ix->jNumTiles + j].tt) == NULL)
+	continue;
+      tt->top = i > 0 ? ix->tiles[(i-1)*ix->jNumTiles + j].tt : NULL;
+      tt->bottom = i < ix->iNumTiles - 1 ? 
+	ix->tiles[(i+1)*ix->jNumTiles + j].tt : NULL;
+      tt->left = j > 0 ? ix->tiles[i*ix->jNumTiles + j-1].tt : NULL;
+      tt->right = j < ix->jNumTiles - 1 ? 
+	ix->tiles[i*ix->jNumTiles + j+1].tt : NULL;
+    }
+
+  ix->numTris = 0;
+  ix->numBuckets = 0;
+  for(i = 0; i < ix->iNumTiles * ix->jNumTiles; i++){
+    if(ix->tiles[i].tt == NULL)
+      continue;
+    buildTileIndex(&ix->tiles[i],&ix->walkSteps);
+    ix->numTris += ix->tiles[i].tt->numTris;
+    ix->tiles[i].base = ix->numBuckets;
+    ix->numBuckets += ix->tiles[i].rows * ix->tiles[i].cols;
+  }
+  return ix;
+}
+
+
+//
+// Free a locator, but not its TIN
+//
+void freeTinIndex(TIN_INDEX *ix){
+  int i;
+  for(i = 0; i < ix->iNumTiles * ix->jNumTiles; i++)
+    free(ix->tiles[i].start);
+  free(ix->tiles);
+  free(ix);
+}
+
+
+//
+// Height of the TIN at (x,y), or the nodata value if (x,y) is off the
+// grid or in a triangle with a nodata corner. steps and fallbacks of
+// the walk are added to *steps and *fallbacks
+//
+double queryPoint(TIN_INDEX *ix, double x, double y,
+		  unsigned long *steps, unsigned long *fallbacks){
+  TILE_INDEX *ti;
+  TRIANGLE *t;
+
+  if(findBucket(ix,x,y,&ti) == ix->numBuckets ||
+     (t = locateInTile(ti,x,y,steps,fallbacks)) == NULL)
+    return ix->tin->nodata;
+  return planeZ(ti->tt,t,x,y);
+}
+
+
+//
+// Add point s of the segment from (x0,y0) by (dx,dy) with height z
+// to profile p, unless it is the last point. Two points at the same
+// place with different heights are a step, from or to nodata
+//
+static void addProfilePoint(PROFILE *p, double s, double x0, double y0,
+			    double dx, double dy, double z){
+  PROFILE_POINT *q;
+
+  if(p->count > 0 && s - p->pts[p->count-1].s < QUERY_SEG_EPS &&
+     fabs(z - p->pts[p->count-1].z) < QUERY_SEG_EPS)
+    return;
+  if(p->count == p->size){
+    p->size = p->size ? 2 * p->size : 64;
+    p->pts = (PROFILE_POINT*)realloc(p->pts, p->size * sizeof(PROFILE_POINT));
+    assert(p->pts);
+  }
+  q = &p->pts[p->count++];
+  q->s = s;
+  q->x = x0 + s * dx;
+  q->y = y0 + s * dy;
+  q->z = z;
+}
+
+
+//
+// Profile of the TIN along the segment from (x0,y0) to (x1,y1): the
+// points where the segment crosses an edge of a triangle, and its
+// ends, in order. s of a point is its place on the segment, 0 at
+// (x0,y0) and 1 at (x1,y1), and the TIN is linear between two points.
+// The segment goes from a triangle to its neighbor through the edge
+// the segment leaves it by, and from a tile to the next through the
+// tile links. In a tile which is not in the TIN, and in the triangles
+// with a nodata corner, the points have the nodata value. Return 0 if
+// an end is off the grid
+//
+int profileSegment(TIN_INDEX *ix, double x0, double y0, double x1,
+		   double y1, PROFILE *p){
+  double dx = x1 - x0, dy = y1 - y0, s = 0, side = ix->tin->tl - 1;
+  unsigned long maxSteps = 4 * (unsigned long)ix->numTris + 64, step;
+  TILE_INDEX *ti = NULL;
+  TRIANGLE *t = NULL;
+  int i, j, e, stall = 0, relocate = 1;
+
+  p->count = 0;
+  if(!findTile(ix,x0,y0,&i,&j) || !findTile(ix,x1,y1,&i,&j))
+    return 0;
+
+  for(step = 0; step < maxSteps; step++){
+
+    // Find the tile and triangle at s, or just past s to take the
+    // triangle the segment goes into
+    if(relocate){
+      double r = MIN(1, step ? s + QUERY_SEG_EPS : 0);
+      findTile(ix,x0 + r * dx,y0 + r * dy,&i,&j);
+      ti = tileAt(ix,i,j);
+      t = ti ? locateInTile(ti,x0 + r * dx,y0 + r * dy,&p->steps,
+			    &p->fallbacks) : NULL;
+      if(t != NULL)
+	addProfilePoint(p,s,x0,y0,dx,dy,planeZ(ti->tt,t,x0 + s*dx,y0 + s*dy));
+      relocate = 0;
+      stall = 0;
+    }
+
+    // A tile which is not in the TIN is skipped to where the segment
+    // leaves its square
+    if(t == NULL){
+      double out = 1;
+      addProfilePoint(p,s,x0,y0,dx,dy,ix->tin->nodata);
+      if(dx > 0)
+	out = MIN(out, ((i + 1) * side - x0) / dx);
+      if(dx < 0)
+	out = MIN(out, (i * side - x0) / dx);
+      if(dy > 0)
+	out = MIN(out, ((j + 1) * side - y0) / dy);
+      if(dy < 0)
+	out = MIN(out, (j * side - y0) / dy);
+      s = MAX(s, MIN(1, out));
+      addProfilePoint(p,s,x0,y0,dx,dy,ix->tin->nodata);
+      if(s >= 1)
+	return 1;
+      relocate = 1;
+      continue;
+    }
+
+    // The segment leaves t by the edge, among those with (x1,y1) on
+    // their outer side, whose line it crosses first
+    R_POINT *pt[3] = {t->p1, t->p2, t->p3};
+    TRIANGLE *nbr[3] = {t->p1p2, t->p2p3, t->p1p3};
+    double o = orient(t->p1,t->p2,t->p3->x,t->p3->y) > 0 ? 1 : -1;
+    double out = 2, oA, oB, c;
+    int exitEdge = -1;
+    for(e = 0; e < 3; e++){
+      oB = orient(pt[e],pt[(e+1)%3],x1,y1) * o;
+      if(oB >= 0)
+	continue;
+      oA = orient(pt[e],pt[(e+1)%3],x0,y0) * o;
+      c = oA / (oA - oB);
+      if(c < out){
+	out = c;
+	exitEdge = e;
+      }
+    }
+    if(exitEdge < 0){
+      addProfilePoint(p,1,x0,y0,dx,dy,planeZ(ti->tt,t,x1,y1));
+      return 1;
+    }
+
+    // Through a vertex the walk may turn around it without moving on
+    if(out <= s + QUERY_SEG_EPS)
+      stall++;
+    else
+      stall = 0;
+    s = MAX(s, out);
+    addProfilePoint(p,s,x0,y0,dx,dy,planeZ(ti->tt,t,x0 + s*dx,y0 + s*dy));
+    if(s >= 1)
+      return 1;
+    if(stall > 3){
+      relocate = 1;
+      continue;
+    }
+    if(nbr[exitEdge] != NULL){
+      t = nbr[exitEdge];
+      continue;
+    }
+
+    // The edge is on the boundary of the tile: go to the neighbor
+    // tile on the side(s) the segment leaves by
+    TIN_TILE *tt = ti->tt, *next = tt;
+    double x = x0 + s * dx, y = y0 + s * dy;
+    int di = 0, dj = 0;
+    if(dx < 0 && x <= tt->iOffset + QUERY_SEG_EPS)
+      di = -1;
+    if(dx > 0 && x >= tt->iOffset + tt->nrows - 1 - QUERY_SEG_EPS)
+      di = 1;
+    if(dy < 0 && y <= tt->jOffset + QUERY_SEG_EPS)
+      dj = -1;
+    if(dy > 0 && y >= tt->jOffset + tt->ncols - 1 - QUERY_SEG_EPS)
+      dj = 1;
+    if(di == 0 && dj == 0){
+      relocate = 1;
+      continue;
+    }
+    i += di;
+    j += dj;
+    if(i < 0 || j < 0 || i >= ix->iNumTiles || j >= ix->jNumTiles)
+      return 1;
+    next = di < 0 ? next->top : di > 0 ? next->bottom : next;
+    if(next != NULL)
+      next = dj < 0 ? next->left : dj > 0 ? next->right : next;
+    if(next == NULL){
+      // Diagonal through a missing tile, or into one
+      ti = tileAt(ix,i,j);
+      t = NULL;
+      if(ti == NULL)
+	continue;
+    }
+    else
+      ti = &ix->tiles[i*ix->jNumTiles + j];
+    assert(ti->tt->iOffset == i * side && ti->tt->jOffset == j * side);
+    x = x0 + MIN(1, s + QUERY_SEG_EPS) * dx;
+    y = y0 + MIN(1, s + QUERY_SEG_EPS) * dy;
+    t = locateInTile(ti,x,y,&p->steps,&p->fallbacks);
+    if(t != NULL)
+      addProfilePoint(p,s,x0,y0,dx,dy,planeZ(ti->tt,t,x0 + s*dx,y0 + s*dy));
+  }
+  return 1;
+}
+
+
+//
+// Is the target at height h1 above the TIN at (x1,y1) visible from an
+// observer at height h0 above (x0,y0)? The TIN is linear between the
+// points of the profile, so the sight line only has to pass above
+// them. Points with the nodata value do not block. Return 1 if
+// visible, 0 if not, -1 if an end is off the grid or nodata. p is
+// the buffer of the profile
+//
+int lineOfSight(TIN_INDEX *ix, double x0, double y0, double h0, 
+		double x1, double y1, double h1, PROFILE *p){
+  double z0, z1;
+  int k;
+
+  if(!profileSegment(ix,x0,y0,x1,y1,p) || p->count < 2 ||
+     p->pts[0].z == ix->tin->nodata || 
+     p->pts[p->count-1].z == ix->tin->nodata)
+    return -1;
+  z0 = p->pts[0].z + h0;
+  z1 = p->pts[p->count-1].z + h1;
+  for(k = 1; k < p->count - 1; k++)
+    if(p->pts[k].z != ix->tin->nodata &&
+       p->pts[k].z > z0 + p->pts[k].s * (z1 - z0))
+      return 0;
+  return 1;
+}
+
+
+//
+// Order of the n points (x,y) by bucket, the points off the TIN go
+// last
+//
+static long *sortByBucket(TIN_INDEX *ix, double *x, double *y, long n){
+  unsigned int nb = ix->numBuckets + 1, b;
+  long *count = (long*)calloc(nb + 1, sizeof(long));
+  long *order = (long*)malloc(n * sizeof(long));
+  unsigned int *bucket = (unsigned int*)malloc(n * sizeof(unsigned int));
+  TILE_INDEX *ti;
+  long i;
+  assert(count && order && bucket);
+
+  // Counting sort
+  for(i = 0; i < n; i++){
+    bucket[i] = findBucket(ix,x[i],y[i],&ti);
+    count[bucket[i] + 1]++;
+  }
+  for(b = 1; b <= nb; b++)
+    count[b] += count[b-1];
+  for(i = 0; i < n; i++)
+    order[count[bucket[i]]++] = i;
+  free(bucket);
+  free(count);
+  return order;
+}
+
+
+//
+// Split the n queries of c[0] in order between numThreads threads
+// running worker, the calling thread takes the last chunk. The walk
+// counters are added to the locator
+//
+static void runChunks(TIN_INDEX *ix, QUERY_CHUNK *c, long n, int numThreads,
+		      void *(*worker)(void *)){
+  QUERY_CHUNK *chunks;
+  pthread_t *threads;
+  int k;
+
+  if(numThreads < 1)
+    numThreads = 1;
+  chunks = (QUERY_CHUNK*)malloc(numThreads * sizeof(QUERY_CHUNK));
+  threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
+  assert(chunks && threads);
+  for(k = 0; k < numThreads; k++){
+    chunks[k] = *c;
+    chunks[k].from = n * k / numThreads;
+    chunks[k].to = n * (k + 1) / numThreads;
+    chunks[k].steps = 0;
+    chunks[k].fallbacks = 0;
+  }
+
+  for(k = 0; k < numThreads - 1; k++)
+    if(pthread_create(&threads[k],NULL,worker,&chunks[k]) != 0){
+      perror("query: pthread_create");
+      exit(1);
+    }
+  worker(&chunks[numThreads - 1]);
+  for(k = 0; k < numThreads; k++){
+    if(k < numThreads - 1)
+      pthread_join(threads[k],NULL);
+    ix->walkSteps += chunks[k].steps;
+    ix->fallbacks += chunks[k].fallbacks;
+  }
+  free(threads);
+  free(chunks);
+}
+
+
+//
+// Thread answering the queries of a chunk
+//
+static void *queryWorker(void *arg){
+  QUERY_CHUNK *c = (QUERY_CHUNK*)arg;
+  long i, q;
+
+  for(i = c->from; i < c->to; i++){
+    q = c->order[i];
+    c->z[q] = queryPoint(c->ix,c->x[q],c->y[q],&c->steps,&c->fallbacks);
+  }
+  return NULL;
+}
+
+
+//
+// Heights z of the n queries (x,y), answered by numThreads threads in
+// the order of their buckets
+//
+void queryBatch(TIN_INDEX *ix, double *x, double *y, double *z, long n,
+		int numThreads){
+  QUERY_CHUNK c;
+
+  memset(&c, 0, sizeof(QUERY_CHUNK));
+  c.ix = ix;
+  c.order = sortByBucket(ix,x,y,n);
+  c.x = x;
+  c.y = y;
+  c.z = z;
+  runChunks(ix,&c,n,numThreads,queryWorker);
+  free(c.order);
+}
+
+
+//
+// Thread answering the sight lines of a chunk
+//
+static void *losWorker(void *arg){
+  QUERY_CHUNK *c = (QUERY_CHUNK*)arg;
+  PROFILE p;
+  long i, q;
+
+  memset(&p, 0, sizeof(PROFILE));
+  for(i = c->from; i < c->to; i++){
+    q = c->order[i];
+    c->visible[q] = lineOfSight(c->ix,c->x[q],c->y[q],c->h0,
+				c->x1[q],c->y1[q],c->h1,&p);
+  }
+  c->steps += p.steps;
+  c->fallbacks += p.fallbacks;
+  free(p.pts);
+  return NULL;
+}
+
+
+//
+// Visibility of the n sight lines from (x0,y0) to (x1,y1) as in
+// lineOfSight, answered by numThreads threads in the order of the
+// buckets of their observers
+//
+void losBatch(TIN_INDEX *ix, double *x0, double *y0, double *x1, double *y1,
+	      double h0, double h1, signed char *visible, long n,
+	      int numThreads){
+  QUERY_CHUNK c;
+
+  memset(&c, 0, sizeof(QUERY_CHUNK));
+  c.ix = ix;
+  c.order = sortByBucket(ix,x0,y0,n);
+  c.x = x0;
+  c.y = y0;
+  c.x1 = x1;
+  c.y1 = y1;
+  c.h0 = h0;
+  c.h1 = h1;
+  c.visible = visible;
+  runChunks(ix,&c,n,numThreads,losWorker);
+  free(c.order);
+}
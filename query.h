@@ -0,0 +1,150 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * query.h answers batches of elevation queries on a TIN read with
+ * readTinFile
+ *
+ * COMMENTS:
+ *
+ * A query (x,y) is in the coordinates of the TIN, x the row and y the
+ * column of the grid, and may fall between cells. The tile of a query
+ * follows from the tiling. Each tile has a grid of buckets holding
+ * the triangle at the center of the bucket, from which a walk along
+ * the neighbors of the triangles reaches the triangle of the query
+ * (jump and walk). The queries of a batch are sorted by bucket, so
+ * the queries of a thread stay in a few tiles.
+ *
+ *****************************************************************************/
+
+#ifndef __query_h
+#define __query_h
+
+#include "tin.h"
+
+// Triangles per bucket of the locator
+#define QUERY_TRIS_PER_BUCKET 2
+
+// Length, as a part of the segment, under which two points of a
+// profile are the same
+#define QUERY_SEG_EPS 1e-9
+
+//
+// Locator of a tile
+//
+typedef struct tile_index {
+  TIN_TILE *tt;             // NULL if the tile is not in the TIN
+  double bucketSide;        // side of a bucket in cells
+  unsigned int rows;        // buckets along x
+  unsigned int cols;        // buckets along y
+  unsigned int base;        // number of the first bucket in the TIN
+  TRIANGLE **start;         // triangle at the center of each bucket
+} TILE_INDEX;
+
+//
+// Locator of a TIN
+//
+typedef struct tin_index {
+  TIN *tin;
+  int iNumTiles;
+  int jNumTiles;
+  TILE_INDEX *tiles;        // iNumTiles x jNumTiles, row major
+  unsigned int numTris;     // triangles of all the tiles
+  unsigned int numBuckets;  // buckets of all the tiles
+  unsigned long walkSteps;  // neighbors walked by the queries
+  unsigned long fallbacks;  // queries whose walk failed
+} TIN_INDEX;
+
+//
+// A point of a profile, s is its place on the segment from 0 to 1
+//
+typedef struct profile_point {
+  double s;
+  double x;
+  double y;
+  double z;
+} PROFILE_POINT;
+
+//
+// Points of a profile, the buffer is reused from one profile to the
+// next
+//
+typedef struct profile {
+  PROFILE_POINT *pts;
+  int count;
+  int size;
+  unsigned long steps;      // triangles walked by the locator
+  unsigned long fallbacks;
+} PROFILE;
+
+//
+// Build the locator of a TIN read with readTinFile
+//
+TIN_INDEX *buildTinIndex(TIN *tin);
+
+//
+// Free a locator, but not its TIN
+//
+void freeTinIndex(TIN_INDEX *ix);
+
+//
+// Height of the TIN at (x,y), or the nodata value if (x,y) is off the
+// grid or in a triangle with a nodata corner. steps and fallbacks of
+// the walk are added to *steps and *fallbacks
+//
+double queryPoint(TIN_INDEX *ix, double x, double y,
+		  unsigned long *steps, unsigned long *fallbacks);
+
+//
+// Heights z of the n queries (x,y), answered by numThreads threads in
+// the order of their buckets
+//
+void queryBatch(TIN_INDEX *ix, double *x, double *y, double *z, long n,
+		int numThreads);
+
+//
+// Profile of the TIN along the segment from (x0,y0) to (x1,y1): the
+// points where the segment crosses an edge of a triangle, and its
+// ends, in order. The segment goes from a triangle to its neighbor
+// through the edge the segment leaves it by, and from a tile to the
+// next through the tile links. In a tile which is not in the TIN, and
+// in the triangles with a nodata corner, the points have the nodata
+// value. Return 0 if an end is off the grid
+//
+int profileSegment(TIN_INDEX *ix, double x0, double y0, double x1,
+		   double y1, PROFILE *p);
+
+//
+// Is the target at height h1 above the TIN at (x1,y1) visible from an
+// observer at height h0 above (x0,y0)? Points with the nodata value do
+// not block. Return 1 if visible, 0 if not, -1 if an end is off the
+// grid or nodata. p is the buffer of the profile
+//
+int lineOfSight(TIN_INDEX *ix, double x0, double y0, double h0, 
+		double x1, double y1, double h1, PROFILE *p);
+
+//
+// Visibility of the n sight lines from (x0,y0) to (x1,y1) as in
+// lineOfSight, answered by numThreads threads in the order of the
+// buckets of their observers
+//
+void losBatch(TIN_INDEX *ix, double *x0, double *y0, double *x1, double *y1,
+	      double h0, double h1, signed char *visible, long n,
+	      int numThreads);
+
+#endif
@@ -33,6 +33,8 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "mem_manager.h"
+
 #define DEBUG if(0)
 
 //
@@ -46,7 +48,7 @@
 //of the list
 //
 QUEUE Q_init(){ 
-  QNODE* n = (QNODE*)malloc(sizeof(QNODE));
+  QNODE* n = (QNODE*)memAlloc(MEM_QUEUE, sizeof(QNODE));
   assert(n);
   n->next = n;
   DEBUG{printf("Q_init %p\n",n);fflush(stdout);}
@@ -67,7 +69,7 @@ void Q_insert_elem_head(QUEUE h, queueElem e){
     fflush(stdout);
   }
 
-  QNODE* n = (QNODE*)malloc(sizeof(QNODE));
+  QNODE* n = (QNODE*)memAlloc(MEM_QUEUE, sizeof(QNODE));
   assert(n);
   n->e.x = e.x;
   n->e.y = e.y;
@@ -125,20 +127,19 @@ short Q_delete_first(QUEUE h){
     f = Q_first(h);
     assert(f);
     h->next = f->next;
-    free(f);
+    memFree(MEM_QUEUE, f, sizeof(QNODE));
     return 1;
   }
 } 
 
 
 //
-// Free all the elements in the queue
+// Free all the elements in the queue and its head
 //
 void Q_free_queue(QUEUE h){
   assert(h);
   while(Q_delete_first(h));
-  //free(h);
-  h = NULL;
+  memFree(MEM_QUEUE, h, sizeof(QNODE));
 }
 
 
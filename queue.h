@@ -69,7 +69,7 @@ QNODE* Q_remove_first(QUEUE h);
 short Q_delete_first(QUEUE h);
 
 //
-// Free all the elements in the queue
+// Free all the elements in the queue and its head
 //
 void Q_free_queue(QUEUE h);
 
@@ -33,8 +33,12 @@
 #include <math.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <sys/time.h>
 
 #include "tin.h"
+#include "stats.h"
+#include "mem_manager.h"
+#include "trace.h"
 
 #ifdef __GRASS__
 #include "grass.h"
@@ -51,6 +55,58 @@ extern TIN *tinGlobal;
 // error for a given triangle is less than e and thus it is 'done'
 extern R_POINT *DONE;
 
+// Refinement options and point movement counters
+REFINE_OPTS refineOpts;
+REFINE_STATS refineStats;
+
+// Convergence curve, NULL when not recorded
+unsigned long *curvePoints = NULL;
+
+// Points inserted in all tiles, for the convergence curve
+static unsigned long curveInserted = 0;
+
+// Progress of refineTin
+static REFINE_PROGRESS progress;
+
+
+//
+// Does point p with error err replace maxE, the max error point so
+// far with error maxErr? Larger errors win and equal errors go to the
+// smaller (x,y), so the max error point of a triangle does not depend
+// on the order of its point list. maxE is DONE or NULL when there is
+// none yet, p then only has to reach maxErr
+//
+static inline short isNewMaxE(ELEV_TYPE err, R_POINT *p, ELEV_TYPE maxErr,
+			      R_POINT *maxE){
+  if(err != maxErr)
+    return err > maxErr;
+  if(maxE == DONE || maxE == NULL)
+    return 1;
+  return p->x < maxE->x || (p->x == maxE->x && p->y < maxE->y);
+}
+
+//
+// Which of the n new triangles in t gets point p? A point on an edge
+// of two of them goes to the one that owns the edge, a point on an
+// edge to a triangle that is not in t stays in the one it is in. NULL
+// entries are skipped. Returns -1 if p is in none of them
+//
+static inline int pickTri(TRIANGLE **t, unsigned int n, R_POINT *p){
+  unsigned int k;
+  int own, onEdge = -1;
+
+  for(k = 0; k < n; k++){
+    if(t[k] == NULL)
+      continue;
+    own = ownsPoint2D(t[k]->p1, t[k]->p2, t[k]->p3, p);
+    if(own > 0)
+      return k;
+    if(own < 0 && onEdge < 0)
+      onEdge = k;
+  }
+  return onEdge;
+}
+
 //
 // Initialize TIN structure, returns a pointer to lower left tri. This
 // will not initialize the points in the triangles, just the two
@@ -64,17 +120,11 @@ TIN_TILE* initTinTile(TIN_TILE *tt,TIN_TILE *leftTile, TIN_TILE *topTile,
   // Create a pointer to the lower left tri in the tin
   TRIANGLE *first, *second;
 
-  // Create a PQ of the error of the triangles. We want to give the PQ
-  // an initial size which is the lowest power of 2 which will fit all
-  // the triangles in a tile (3 * numPoints in tile) = (3 * tin->tl *tin->tl)
-  //
-  // If TL is larger than 4000 then we are probably running untiled
-  // and we should start the pq small and just let it grow as needed
-  unsigned int initPQSize = 1048576;
-  if(tin->tl < 4000)
-    initPQSize = (unsigned int)	pow(2,ceil(log10(3 * tin->tl * tin->tl)
-					   /log10(2)));
-  tt->pq = PQ_initialize( initPQSize );
+  // The PQ is created when the tile is refined
+  tt->pq = NULL;
+  initTriArena(&tt->tris);
+  initVertexPool(&tt->verts);
+  tt->pointIndex = NULL;
 
 
   // Set Offset
@@ -88,6 +138,18 @@ TIN_TILE* initTinTile(TIN_TILE *tt,TIN_TILE *leftTile, TIN_TILE *topTile,
   // Number of triangles and points
   tt->numTris = 2;
   tt->numPoints = 4;
+
+  // The swap pool is only allocated while refining in lazy mode
+  tt->swapPool = NULL;
+  tt->swapPoolCount = tt->swapPoolSize = 0;
+  tt->dirtyTris = NULL;
+  tt->dirtyCount = tt->dirtySize = 0;
+  tt->swapping = 0;
+  tt->seeds = NULL;
+  tt->seedErr = NULL;
+  tt->batchTris = NULL;
+  tt->batchPts = NULL;
+  tt->batchCount = tt->batchSize = 0;
   
   // Point neighbors to me
   pointNeighborTileTo(tt,DIR_BOTTOM,topTile);
@@ -97,25 +159,25 @@ TIN_TILE* initTinTile(TIN_TILE *tt,TIN_TILE *leftTile, TIN_TILE *topTile,
   // intial triangulation. They have incorrect z value for now and
   // will be updated later
   if(nw == NULL){
-    nw = (R_POINT*)malloc(sizeof(R_POINT));
+    nw = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
     nw->x=iOffset;
     nw->y=jOffset;
     nw->z=0;
   }
   if(ne == NULL){
-    ne = (R_POINT*)malloc(sizeof(R_POINT));
+    ne = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
     ne->x=iOffset;
     ne->y=tt->ncols-1+jOffset;
     ne->z=0;
   }
   if(sw == NULL){
-    sw = (R_POINT*)malloc(sizeof(R_POINT));
+    sw = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
     sw->x=tt->nrows-1+iOffset;
     sw->y=jOffset;
     sw->z=0;
   }
   
-  R_POINT *se = (R_POINT*)malloc(sizeof(R_POINT));
+  R_POINT *se = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
   se->x=tt->nrows-1+iOffset;
   se->y=tt->ncols-1+jOffset;
   se->z=0;
@@ -250,8 +312,22 @@ TIN *initTin(TILED_GRID *fullGrid, double e, double mem, short useNodata,
       else 
 	tt->ncols = TL;
  
-      tt->min = fullGrid->min;
-      tt->max = fullGrid->max;
+      // Heights of the valid points of this tile. Nodata points which
+      // are used get the same height in all tiles so the tiles agree
+      // on their boundaries
+      // The tile takes over the runs of valid cells, it frees them
+      // once it is read
+      tt->gridStats = fullGrid->stats[i][j];
+      fullGrid->stats[i][j].runs = NULL;
+      if(tt->gridStats.numValid > 0){
+	tt->min = tt->gridStats.min;
+	tt->max = tt->gridStats.max;
+      }
+      else{
+	tt->min = fullGrid->min;
+	tt->max = fullGrid->max;
+      }
+      tt->nodataZ = fullGrid->min-1;
       tt->nodata = fullGrid->nodata;
       tt->gridFile = fullGrid->files[i][j];
 
@@ -318,108 +394,396 @@ TIN *initTin(TILED_GRID *fullGrid, double e, double mem, short useNodata,
 
 
 //
-// Add the points two the two initial triangles of a Tin tile from
-// file. Also add points from neighbor boundary arrays to the
-// triangulation to have boundary consistancy
+// A tile is flat if the height range of its grid is below e. Every
+// point is then within e of the two initial triangles since their
+// corners are grid points of the tile too. e is truncated to
+// ELEV_TYPE as in the refinement, where a point of error (ELEV_TYPE)e
+// is still inserted
 //
-TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
+short isFlatTile(TIN_TILE *tt, double e){
+  return (tt->gridStats.numNodata == 0 && 
+	  tt->max - tt->min < (ELEV_TYPE)e);
+}
+
+
+//
+// A tile is empty if all its grid points are nodata and nodata
+// points are skipped. Then there is nothing to refine
+//
+short isEmptyTile(TIN_TILE *tt, short useNodata){
+  return (!useNodata && 
+	  tt->gridStats.numNodata == (unsigned int)tt->nrows*tt->ncols);
+}
+
+
+//
+// Initialize a flat or empty tile. Only the heights of the corners
+// are read from the tile file and the two initial triangles are
+// marked done without building point lists
+//
+void initFlatTile(TIN_TILE *tt){
 
   // First two tris
   TRIANGLE *first = tt->t;
   TRIANGLE *second = tt->t->p1p3;
 
-  // Get back to the beginning of the tile data file
-  rewind(tt->gridFile);
+  // The tile file is stored by rows
+  long lastRow = (long)(tt->nrows-1) * tt->ncols * sizeof(ELEV_TYPE);
+  long lastCol = (long)(tt->ncols-1) * sizeof(ELEV_TYPE);
+
+  fseek(tt->gridFile,0,SEEK_SET);
+  fread(&tt->nw->z,sizeof(ELEV_TYPE), 1, tt->gridFile);
+  fseek(tt->gridFile,lastCol,SEEK_SET);
+  fread(&tt->ne->z,sizeof(ELEV_TYPE), 1, tt->gridFile);
+  fseek(tt->gridFile,lastRow,SEEK_SET);
+  fread(&tt->sw->z,sizeof(ELEV_TYPE), 1, tt->gridFile);
+  fseek(tt->gridFile,lastRow + lastCol,SEEK_SET);
+  fread(&tt->se->z,sizeof(ELEV_TYPE), 1, tt->gridFile);
+
+  first->maxE = second->maxE = DONE;
+  first->points = second->points = NULL;
+  first->maxErrorValue = second->maxErrorValue = 0;
+}
 
-  // Now build list of points in the triangle
-  // Create a dummy tail for both point lists
-  first->points = Q_init();
-  second->points = Q_init();
-  first->maxE = DONE;
-  second->maxE = DONE;
-  
-  // Build the two point lists
-  register int row, col;
-  ELEV_TYPE maxE_first=0;
-  ELEV_TYPE maxE_second=0;
+
+//
+// Add a grid point of a tile read from file at (row,col) of the tile
+// to the point list of one of the two initial triangles
+//
+void addInitialPoint(TIN_TILE *tt, int row, int col, ELEV_TYPE z,
+		     short useNodata){
+
+  // First two tris
+  TRIANGLE *first = tt->t;
+  TRIANGLE *second = tt->t->p1p3;
   ELEV_TYPE tempE = 0;
-  
   R_POINT temp;
-  
-  // iterate through all points and distribute them to the 
-  // two triangles
-  for(row=0;row<tt->nrows;row++) {
-    temp.x=row+tt->iOffset;
-    for(col=0;col<tt->ncols;col++) {
-      temp.y=col+tt->jOffset;
-      fread(&temp.z,sizeof(ELEV_TYPE), 1, tt->gridFile);
-      // Only set Z values for corner points since they already exist
-      if(row==0 && col==0){
-	tt->nw->z = temp.z;
-	continue;
+
+  temp.x=row+tt->iOffset;
+  temp.y=col+tt->jOffset;
+  temp.z=z;
+
+  // Only set Z values for corner points since they already exist
+  if(row==0 && col==0){
+    tt->nw->z = temp.z;
+    return;
+  }
+  if(row==0 && col==tt->ncols-1){
+    tt->ne->z = temp.z;
+    return;
+  }
+  if(row==tt->nrows-1 && col==tt->ncols-1){
+    tt->se->z = temp.z;
+    return;
+  } 
+  if(row==tt->nrows-1 && col==0){
+    tt->sw->z = temp.z;
+    return;
+  }	
+  //Ignore edge points if internal tile
+  if(tt->iOffset != 0 && row == 0)
+    return;
+  if(tt->jOffset != 0 && col == 0)
+    return;
+      
+  //Skip nodata or change it to min-1
+  if(temp.z == tt->nodata){
+    if(!useNodata)
+      return;
+    else
+      temp.z = tt->nodataZ;
+  }
+
+  // Add to the first triangle's list. A point on the diagonal goes
+  // to the triangle that owns it, a point on the tile boundary to the
+  // only triangle that has it
+  int own = ownsPoint2D(first->p1, first->p2, first->p3, &temp);
+  if(own > 0 || (own < 0 && 
+		 !inTri2D(second->p1, second->p2, second->p3, &temp))) {
+	
+    Q_insert_elem_head(first->points, temp);
+
+    //Update max error
+    tempE = findError(temp.x,temp.y,temp.z,first);
+    if(tt->seeds != NULL)
+      updateSeed(tt,row,col,&temp,tempE);
+    if (tempE > first->maxErrorValue) {
+      assert(Q_first(first->points));
+      // store pointer to triangle w/ max err
+      first->maxE = &Q_first(first->points)->e;
+      first->maxErrorValue = tempE;
+    }
+  }
+  // Add to the second triangle's list
+  else {
+
+    assert(inTri2D(second->p1, second->p2, second->p3, &temp));
+
+    Q_insert_elem_head(second->points, temp);
+
+    //Update max error
+    tempE = findError(temp.x,temp.y,temp.z,second);
+    if(tt->seeds != NULL)
+      updateSeed(tt,row,col,&temp,tempE);
+    if (tempE > second->maxErrorValue) {
+      assert(Q_first(second->points));
+      // store pointer to triangle w/ max err
+      second->maxE = &Q_first(second->points)->e; 
+      second->maxErrorValue = tempE;
+    }
+  }
+}
+
+
+//
+// Set the corners of a tile which are in the cells [from,to) of the
+// tile file (in row major order) to nodata. This is used when reading
+// only the runs of valid cells of a tile, for the cells in between.
+//
+void setSkippedCorners(TIN_TILE *tt, long from, long to){
+  long last = (long)tt->nrows * tt->ncols - 1;
+
+  if(from <= 0 && 0 < to)
+    tt->nw->z = tt->nodata;
+  if(from <= tt->ncols-1 && tt->ncols-1 < to)
+    tt->ne->z = tt->nodata;
+  if(from <= last - (tt->ncols-1) && last - (tt->ncols-1) < to)
+    tt->sw->z = tt->nodata;
+  if(from <= last && last < to)
+    tt->se->z = tt->nodata;
+}
+
+
+//
+// Split the dense tile buf into the two initial triangles using
+// refineOpts.distrThreads threads. The point lists, max errors and
+// seeds are the same as the ones of addInitialPoint called on every
+// cell in row major order
+//
+void splitTileCells(TIN_TILE *tt, ELEV_TYPE *buf, short useNodata){
+  TRIANGLE *first = tt->t;
+  TRIANGLE *second = tt->t->p1p3;
+  R_POINT *old[4] = {tt->nw, tt->ne, tt->sw, tt->se};
+  R_POINT corners[3][4];
+  TRIANGLE phase[3][2];
+  int i, j, k, nchunks, rows, step = 1;
+
+  // The corners get their heights as they are reached in row major
+  // order. The points of the first row see the new nw, the points of
+  // the middle rows also the new ne and the points of the last row
+  // also the new sw
+  for(i = 0; i < 3; i++){
+    for(j = 0; j < 4; j++)
+      corners[i][j] = *old[j];
+    corners[i][0].z = buf[0];
+    if(i >= 1)
+      corners[i][1].z = buf[tt->ncols-1];
+    if(i >= 2)
+      corners[i][2].z = buf[(long)(tt->nrows-1)*tt->ncols];
+    phase[i][0] = *first;
+    phase[i][1] = *second;
+    for(k = 0; k < 2; k++)
+      for(j = 0; j < 4; j++){
+	if(phase[i][k].p1 == old[j]) phase[i][k].p1 = &corners[i][j];
+	if(phase[i][k].p2 == old[j]) phase[i][k].p2 = &corners[i][j];
+	if(phase[i][k].p3 == old[j]) phase[i][k].p3 = &corners[i][j];
       }
-      if(row==0 && col==tt->ncols-1){
-	tt->ne->z = temp.z;
-	continue;
+  }
+
+  // Seeds blocks must not be shared between chunks
+  if(tt->seeds != NULL)
+    step = refineOpts.seedSpacing;
+  nchunks = refineOpts.distrThreads > 1 ? refineOpts.distrThreads : 1;
+  rows = (tt->nrows + nchunks - 1) / nchunks;
+  rows = (rows + step - 1) / step * step;
+  nchunks = (tt->nrows + rows - 1) / rows;
+
+  INIT_CHUNK *chunks = (INIT_CHUNK*)malloc(nchunks * sizeof(INIT_CHUNK));
+  pthread_t *threads = (pthread_t*)malloc(nchunks * sizeof(pthread_t));
+  assert(chunks && threads);
+
+  for(i = 0; i < nchunks; i++){
+    chunks[i].tt = tt;
+    chunks[i].buf = buf;
+    chunks[i].startRow = i * rows;
+    chunks[i].endRow = MIN((i+1) * rows, tt->nrows);
+    chunks[i].useNodata = useNodata;
+    chunks[i].phase = phase;
+    chunks[i].worker = nchunks == 1 ? -1 : i;
+    if(nchunks == 1)
+      splitTileChunk(&chunks[i]);
+    else if(pthread_create(&threads[i], NULL, splitTileChunk, &chunks[i])){
+      printf("splitTileCells: cannot create thread\n");
+      exit(1);
+    }
+  }
+  if(nchunks > 1)
+    for(i = 0; i < nchunks; i++)
+      pthread_join(threads[i], NULL);
+
+  // Each chunk inserted at the head, so the lists are the chunks in
+  // reverse order. For equal errors the first point wins
+  for(i = 0; i < nchunks; i++){
+    for(k = 0; k < 2; k++){
+      TRIANGLE *t = k ? second : first;
+      if(chunks[i].head[k] != NULL){
+	chunks[i].tail[k]->next = t->points->next;
+	t->points->next = chunks[i].head[k];
       }
-      if(row==tt->nrows-1 && col==tt->ncols-1){
-	tt->se->z = temp.z;
-	continue;
-      } 
-      if(row==tt->nrows-1 && col==0){
-	tt->sw->z = temp.z;
-	continue;
-      }	
-      //Ignore edge points if internal tile
-      if(tt->iOffset != 0 && row == 0)
+      if(chunks[i].max[k] > t->maxErrorValue){
+	t->maxE = chunks[i].maxE[k];
+	t->maxErrorValue = chunks[i].max[k];
+      }
+    }
+  }
+
+  for(j = 0; j < 4; j++)
+    old[j]->z = corners[2][j].z;
+  tt->se->z = buf[(long)tt->nrows*tt->ncols - 1];
+
+  free(threads);
+  free(chunks);
+}
+
+
+//
+// Thread function of splitTileCells, arg is an INIT_CHUNK
+//
+void *splitTileChunk(void *arg){
+  INIT_CHUNK *c = (INIT_CHUNK*)arg;
+  TIN_TILE *tt = c->tt;
+  TRIANGLE *t;
+  QNODE *n;
+  ELEV_TYPE tempE;
+  int row, col, k, lastRow = tt->nrows-1, lastCol = tt->ncols-1;
+
+  if(c->worker >= 0)
+    traceThread(c->worker);
+  TRACE_BEGIN("splitTileChunk");
+  for(k = 0; k < 2; k++){
+    c->head[k] = c->tail[k] = NULL;
+    c->max[k] = 0;
+    c->maxE[k] = NULL;
+  }
+
+  for(row = c->startRow; row < c->endRow; row++){
+    //Ignore edge points if internal tile
+    if(tt->iOffset != 0 && row == 0)
+      continue;
+
+    for(col = 0; col < tt->ncols; col++){
+      // Corners already exist
+      if((row == 0 || row == lastRow) && (col == 0 || col == lastCol))
 	continue;
       if(tt->jOffset != 0 && col == 0)
 	continue;
-      
+
+      ELEV_TYPE z = c->buf[(long)row*tt->ncols + col];
       //Skip nodata or change it to min-1
-      if(temp.z == tt->nodata){
-	if(!useNodata)
-      	  continue;
+      if(z == tt->nodata){
+	if(!c->useNodata)
+	  continue;
 	else
-	  temp.z = tt->min-1;
+	  z = tt->nodataZ;
       }
 
-      // Add to the first triangle's list
-      if(inTri2D(first->p1, first->p2, first->p3, &temp)) {
-	
-	Q_insert_elem_head(first->points, temp);
-
-	//Update max error
-	tempE = findError(temp.x,temp.y,temp.z,first);
-	if (tempE > maxE_first) {
-	  maxE_first = tempE;
-	  assert(Q_first(first->points));
-	  // store pointer to triangle w/ max err
-	  first->maxE = &Q_first(first->points)->e;
-	  first->maxErrorValue = tempE;
-	}
+      // The diagonal from nw to se splits the tile, points on it are
+      // owned by the second triangle (see ownsPoint2D)
+      k = ((long)col*lastRow < (long)row*lastCol) ? 0 : 1;
+      t = &c->phase[row == 0 ? 0 : (row < lastRow ? 1 : 2)][k];
+
+      n = (QNODE*)memAlloc(MEM_QUEUE, sizeof(QNODE));
+      assert(n);
+      n->e.x = row + tt->iOffset;
+      n->e.y = col + tt->jOffset;
+      n->e.z = z;
+      n->next = c->head[k];
+      if(c->head[k] == NULL)
+	c->tail[k] = n;
+      c->head[k] = n;
+
+      //Update max error
+      tempE = findError(n->e.x, n->e.y, n->e.z, t);
+      if(tt->seeds != NULL)
+	updateSeed(tt,row,col,&n->e,tempE);
+      if(tempE > c->max[k]){
+	c->max[k] = tempE;
+	c->maxE[k] = &n->e;
       }
-      // Add to the second triangle's list
-      else {
+    }
+  }
+  TRACE_END("splitTileChunk");
+  statsFlushThread();
+  return NULL;
+}
 
-	assert(inTri2D(second->p1, second->p2, second->p3, &temp));
 
-	Q_insert_elem_head(second->points, temp);
+//
+// Read all the points of a tile from file and distribute them to the
+// point lists of the two initial triangles. If the tile is mostly
+// nodata and we skip nodata then only the runs of valid cells
+// recorded while tiling are read
+//
+void initTilePointLists(TIN_TILE *tt, short useNodata){
+  STATS_START(STAT_TILE_READ);
+  TRACE_BEGIN("readTile");
 
-	//Update max error
-	tempE = findError(temp.x,temp.y,temp.z,second);
-	if (tempE > maxE_second) {
-	  maxE_second = tempE;
-	  assert(Q_first(second->points));
-	  // store pointer to triangle w/ max err
-	  second->maxE = &Q_first(second->points)->e; 
-	  second->maxErrorValue = tempE;
-	}
+  // First two tris
+  TRIANGLE *first = tt->t;
+  TRIANGLE *second = tt->t->p1p3;
 
-      }
+  // Get back to the beginning of the tile data file
+  rewind(tt->gridFile);
 
-    }//for col
-  }//for row
+  // Now build list of points in the triangle
+  // Create a dummy tail for both point lists
+  first->points = Q_init();
+  second->points = Q_init();
+  first->maxE = DONE;
+  second->maxE = DONE;
+  first->maxErrorValue = 0;
+  second->maxErrorValue = 0;
+  
+  // Build the two point lists
+  register int col;
+  unsigned int i;
+  TILE_RUN *r;
+  
+  if(!useNodata && tt->gridStats.runs != NULL && 
+     tt->gridStats.numNodata > (unsigned int)tt->nrows*tt->ncols/2){
+
+    // Corner heights are set when the corner is reached, as in the
+    // dense read, since the errors of the points before it are
+    // computed with the old height
+    long pos = 0, start;
+    ELEV_TYPE *buf = (ELEV_TYPE*)memAlloc(MEM_BUF, 
+					  tt->ncols * sizeof(ELEV_TYPE));
+    assert(buf);
+    for(i=0;i<tt->gridStats.numRuns;i++){
+      r = &tt->gridStats.runs[i];
+      start = (long)r->row*tt->ncols + r->col;
+      setSkippedCorners(tt,pos,start);
+      fseek(tt->gridFile,start*sizeof(ELEV_TYPE),SEEK_SET);
+      fread(buf,sizeof(ELEV_TYPE), r->len, tt->gridFile);
+      for(col=0;col<r->len;col++)
+	addInitialPoint(tt,r->row,r->col+col,buf[col],useNodata);
+      pos = start + r->len;
+    }
+    setSkippedCorners(tt,pos,(long)tt->nrows*tt->ncols);
+    memFree(MEM_BUF, buf, tt->ncols * sizeof(ELEV_TYPE));
+  }
+  else{
+    // read the whole tile and split it between the two triangles
+    long n = (long)tt->nrows * tt->ncols;
+    ELEV_TYPE *buf = (ELEV_TYPE*)memAlloc(MEM_BUF, n * sizeof(ELEV_TYPE));
+    assert(buf);
+    if(fread(buf,sizeof(ELEV_TYPE),n,tt->gridFile) != n){
+      printf("initTilePointLists: cannot read tile\n");
+      exit(1);
+    }
+    splitTileCells(tt,buf,useNodata);
+    memFree(MEM_BUF, buf, n * sizeof(ELEV_TYPE));
+  }
   //end distribute points among initial triangles
 
   DEBUG {checkPointList(first); checkPointList(second);}
@@ -443,16 +807,68 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
   // Insert max error point into the PQ
   else
     PQ_insert(tt->pq,second);
+  TRACE_END("readTile");
+  STATS_STOP(STAT_TILE_READ);
+}
+
+
+//
+// Add the points two the two initial triangles of a Tin tile from
+// file. Also add points from neighbor boundary arrays to the
+// triangulation to have boundary consistancy
+//
+TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
+  TRACE_BEGIN("initTilePoints");
+
+  // A flat or empty tile already fits in its two initial triangles,
+  // so there are no point lists to build and no points will be added
+  short flat = isFlatTile(tt,e) || isEmptyTile(tt,useNodata);
+  if(flat)
+    initFlatTile(tt);
+  else{
+    // Seeds are found while the points are read
+    if(refineOpts.seedSpacing > 1){
+      unsigned int i, s = refineOpts.seedSpacing;
+      tt->seedRows = (tt->nrows + s - 1) / s;
+      tt->seedCols = (tt->ncols + s - 1) / s;
+      tt->seeds = (R_POINT*)memAlloc(MEM_BUF, tt->seedRows * tt->seedCols * 
+				     sizeof(R_POINT));
+      tt->seedErr = (ELEV_TYPE*)memAlloc(MEM_BUF, 
+					 tt->seedRows * tt->seedCols * 
+					 sizeof(ELEV_TYPE));
+      assert(tt->seeds && tt->seedErr);
+      for(i = 0; i < tt->seedRows * tt->seedCols; i++)
+	tt->seedErr[i] = -1;
+    }
+    initTilePointLists(tt,useNodata);
+  }
 
+  // The runs of valid cells are not needed after the tile is read
+  free(tt->gridStats.runs);
+  tt->gridStats.runs = NULL;
 
   // Initialize point pointer arrays
-  // At most points can have (tl*tl)-2*tl points in it
-  // At most bPoints and rPoints can have tl points
-  tt->points = (R_POINT **)malloc( ((tt->nrows * tt->ncols) - 
-				  (tt->nrows + tt->ncols)) * 
-				 sizeof(R_POINT*));
-  tt->bPoints = (R_POINT **)malloc( tt->ncols * sizeof(R_POINT*));
-  tt->rPoints = (R_POINT **)malloc( tt->nrows * sizeof(R_POINT*));  
+  // points has at most the cells off the last row and column,
+  // (nrows-1)*(ncols-1), nw included: the first row and column are
+  // refined here when they are on the edge of the grid
+  // bPoints has at most the last row, ncols points with sw and se
+  // rPoints has at most the last column, nrows points with ne and se
+  // A flat tile only has its corners
+  if(flat){
+    tt->pointsSize = 1;
+    tt->bPointsSize = tt->rPointsSize = 2;
+  }
+  else{
+    tt->pointsSize = (tt->nrows - 1) * (tt->ncols - 1);
+    tt->bPointsSize = tt->ncols;
+    tt->rPointsSize = tt->nrows;
+  }
+  tt->points = (R_POINT **)memAlloc(MEM_POINTS, 
+				    tt->pointsSize * sizeof(R_POINT*));
+  tt->bPoints = (R_POINT **)memAlloc(MEM_POINTS, 
+				     tt->bPointsSize * sizeof(R_POINT*));
+  tt->rPoints = (R_POINT **)memAlloc(MEM_POINTS, 
+				     tt->rPointsSize * sizeof(R_POINT*));
 
   // Add points to point pointer array
   tt->points[0]=tt->nw;//nw
@@ -497,12 +913,11 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
       triangleCheck(s,t1,t2,NULL);
       // Distribute points in the 2 triangles
       if(s->maxE != DONE){
-	s->p1p2 = s->p1p3 = s->p2p3 = NULL;
-	distrPoints(t1,t2,NULL,s,NULL,e,tt);
 	//Mark triangle s for deletion from pq before distrpoints so we
 	//can include its maxE in the newly created triangle
-	
+	s->p1p2 = s->p1p3 = s->p2p3 = NULL;
 	PQ_delete(tt->pq,s->pqIndex);
+	distrPoints(t1,t2,NULL,s,NULL,e,tt);
       }
       else{
 	// Since distrpoints normally fixes corner we need to do it here
@@ -514,7 +929,7 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
       }
       
       
-      removeTri(s);
+      removeTri(tt,s);
       tt->numTris++;
       tt->numPoints++;
       // Now split the next lowest boundary triangle
@@ -549,12 +964,11 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
       triangleCheck(s,t1,t2,NULL);
       // Distribute points in the 2 triangles
       if(s->maxE != DONE){
-	distrPoints(t1,t2,NULL,s,NULL,e,tt);
-	//Mark triangle sp for deletion from pq before distrpoints so we
+	//Mark triangle s for deletion from pq before distrpoints so we
 	//can include its maxE in the newly created triangle
 	s->p1p2 = s->p1p3 = s->p2p3 = NULL;
 	PQ_delete(tt->pq,s->pqIndex);
-
+	distrPoints(t1,t2,NULL,s,NULL,e,tt);
       }
       else{
 	// Since distrpoints normally fixes corner we need to do it here
@@ -566,7 +980,7 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
       }
       
       
-      removeTri(s);
+      removeTri(tt,s);
       tt->numTris++;
       tt->numPoints++;
       // Now split the next lowest boundary triangle
@@ -579,6 +993,7 @@ TIN_TILE *initTilePoints(TIN_TILE *tt, double e, short useNodata){
     }
     
   }
+  TRACE_END("initTilePoints");
   return tt;
 }
 
@@ -649,6 +1064,7 @@ int CircumCircle(double xp,double yp,double x1,double y1,
 void edgeSwap(TRIANGLE *t1, TRIANGLE *t2, 
 	      R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *d,
 	      double e, TIN_TILE *tt){
+  STATS_START(STAT_EDGE_SWAP);
 
   // Common edge must be ac
   assert(isEndPoint(t1,a) && isEndPoint(t1,b) && isEndPoint(t1,c) && 
@@ -687,6 +1103,31 @@ void edgeSwap(TRIANGLE *t1, TRIANGLE *t2,
   printTriangle(tn2);
   } 
 
+  refineStats.edgeSwaps++;
+
+  // Mark t1 and t2 for deletion before their points are distributed,
+  // so that distrPoints keeps their max error points: unlike a split
+  // triangle, their maxE does not become a corner
+  t1->p1p2 = t1->p1p3 = t1->p2p3 = NULL;
+  t2->p1p2 = t2->p1p3 = t2->p2p3 = NULL;
+
+  // In lazy mode the point lists of t1 and t2 go to the swap pool and
+  // the new triangles stay dirty until flushSwapPoints is called at
+  // the end of the cascade. deferSwapPoints also takes t1 and t2 out
+  // of the PQ or the dirty set.
+  if(tt->swapPool != NULL){
+    short pooled1 = deferSwapPoints(t1,tt);
+    short pooled2 = deferSwapPoints(t2,tt);
+    if(pooled1 || pooled2){
+      markDirty(tn1,tt);
+      markDirty(tn2,tt);
+    }
+    else{
+      tn1->maxE = tn2->maxE = DONE;
+      tn1->points = tn2->points= NULL;
+      tn1->maxErrorValue = tn2->maxErrorValue = 0;
+    }
+  }
   // Distribute point list from t1 and t2 to tn1 and tn2. Distribute
   // points requires that the fourth argument (s) be a valid triangle
   // with a point list so we must check that t1 and t2 are not already
@@ -694,17 +1135,33 @@ void edgeSwap(TRIANGLE *t1, TRIANGLE *t2,
   // call distribute points with s = the trinagle with the valid point
   // list. If both are done then the newly created triangles are done
   // tooand need to be marked accordingly
-  if(t1->maxE != DONE && t2->maxE != DONE)
-    distrPoints(tn1,tn2,NULL,t1,t2,e,tt);
-  else if(t1->maxE != DONE){
-    distrPoints(tn1,tn2,NULL,t1,NULL,e,tt);
-  }
-  else if(t2->maxE != DONE){
-    distrPoints(tn1,tn2,NULL,t2,NULL,e,tt);
-  }
   else{
-    tn1->maxE = tn2->maxE = DONE;
-    tn1->points = tn2->points= NULL;
+    unsigned long moves = refineStats.pointMoves;
+    // A done triangle created earlier in the cascade still has its
+    // points and is in the dirty set instead of the PQ
+    if(t1->maxE == DONE && t1->points != NULL)
+      removeDirty(t1,tt);
+    else
+      PQ_delete(tt->pq,t1->pqIndex);
+    if(t2->maxE == DONE && t2->points != NULL)
+      removeDirty(t2,tt);
+    else
+      PQ_delete(tt->pq,t2->pqIndex);
+    tt->swapping = 1;
+    if(t1->points != NULL && t2->points != NULL)
+      distrPoints(tn1,tn2,NULL,t1,t2,e,tt);
+    else if(t1->points != NULL){
+      distrPoints(tn1,tn2,NULL,t1,NULL,e,tt);
+    }
+    else if(t2->points != NULL){
+      distrPoints(tn1,tn2,NULL,t2,NULL,e,tt);
+    }
+    else{
+      tn1->maxE = tn2->maxE = DONE;
+      tn1->points = tn2->points= NULL;
+    }
+    tt->swapping = 0;
+    refineStats.swapPointMoves += refineStats.pointMoves - moves;
   }
 
   // Update the corner if the corner is being swapped. Distrpoints
@@ -713,13 +1170,12 @@ void edgeSwap(TRIANGLE *t1, TRIANGLE *t2,
     updateTinTileCorner(tt,tn1,tn2,NULL);    
   }
 
-  // mark triangles for deletion from the PQ
-  t1->p1p2 = t1->p1p3 = t1->p2p3 = NULL;
-  t2->p1p2 = t2->p1p3 = t2->p2p3 = NULL;
-  PQ_delete(tt->pq,t1->pqIndex);
-  PQ_delete(tt->pq,t2->pqIndex);
-  removeTri(t1);
-  removeTri(t2);
+  // The edges of t1 and t2 left to check by a batched round
+  if(tt->batchCount > 0)
+    swapBatchEdges(tt,t1,t2,tn1,tn2);
+
+  removeTri(tt,t1);
+  removeTri(tt,t2);
 
   DEBUG{checkPointList(tn1); checkPointList(tn2);}
 
@@ -728,6 +1184,158 @@ void edgeSwap(TRIANGLE *t1, TRIANGLE *t2,
   enforceDelaunay(tn1,a,d,b,e,tt);
   enforceDelaunay(tn2,c,d,b,e,tt);
 
+  STATS_STOP(STAT_EDGE_SWAP);
+}
+
+
+//
+// Lazy edge swaps: move the point list of a triangle consumed by an
+// edge swap into the swap pool of the tile. Returns 1 if the area of
+// t may contain points (t had a point list or was dirty) else 0
+//
+short deferSwapPoints(TRIANGLE *t, TIN_TILE *tt){
+  assert(t && tt->swapPool);
+
+  // A dirty triangle has no point list of its own, its points are
+  // already in the pool. Take it out of the dirty set
+  if(t->maxE == NULL){
+    removeDirty(t,tt);
+    return 1;
+  }
+
+  // Done triangles have no points
+  if(t->maxE == DONE)
+    return 0;
+
+  assert(t->points);
+  PQ_delete(tt->pq,t->pqIndex);
+
+  // Grow the pool if needed
+  if(tt->swapPoolCount == tt->swapPoolSize){
+    tt->swapPoolSize *= 2;
+    tt->swapPool = (QUEUE*)realloc(tt->swapPool, 
+				   tt->swapPoolSize * sizeof(QUEUE));
+    assert(tt->swapPool);
+  }
+  tt->swapPool[tt->swapPoolCount++] = t->points;
+  t->points = NULL;
+  return 1;
+}
+
+
+//
+// Edge swaps: add a triangle created by an edge swap to the dirty set
+// of the tile. The index in the set is kept in pqIndex while the
+// triangle is not in the PQ
+//
+void addDirty(TRIANGLE *t, TIN_TILE *tt){
+  assert(t && tt->dirtyTris);
+
+  if(tt->dirtyCount == tt->dirtySize){
+    tt->dirtySize *= 2;
+    tt->dirtyTris = (TRIANGLE**)realloc(tt->dirtyTris, 
+					tt->dirtySize * sizeof(TRIANGLE*));
+    assert(tt->dirtyTris);
+  }
+  t->pqIndex = tt->dirtyCount;
+  tt->dirtyTris[tt->dirtyCount++] = t;
+}
+
+
+//
+// Edge swaps: take a triangle consumed by an edge swap out of the
+// dirty set of the tile
+//
+void removeDirty(TRIANGLE *t, TIN_TILE *tt){
+  unsigned int i = t->pqIndex;
+  assert(i < tt->dirtyCount && tt->dirtyTris[i] == t);
+  tt->dirtyTris[i] = tt->dirtyTris[--tt->dirtyCount];
+  tt->dirtyTris[i]->pqIndex = i;
+}
+
+
+//
+// Lazy edge swaps: mark a triangle created by an edge swap as dirty,
+// its point list is built by flushSwapPoints
+//
+void markDirty(TRIANGLE *t, TIN_TILE *tt){
+  // maxE is NULL only for dirty triangles
+  t->maxE = NULL;
+  t->points = NULL;
+  t->maxErrorValue = 0;
+  addDirty(t,tt);
+}
+
+
+//
+// Edge swaps: once the Delaunay cascade is done distribute the points
+// pooled by lazy swaps among the dirty triangles, then insert the
+// dirty triangles in the PQ or free the points of the done ones
+//
+void flushSwapPoints(TIN_TILE *tt, double e){
+  assert(tt->dirtyTris);
+  
+  unsigned int i, j;
+  int k;
+  ELEV_TYPE tempE;
+  TRIANGLE *t;
+  QNODE *cur;
+
+  // Without lazy swaps the dirty triangles are done and have their
+  // point lists already
+  for(i = 0; i < tt->dirtyCount; i++){
+    t = tt->dirtyTris[i];
+    if(t->maxE != NULL)
+      continue;
+    t->points = Q_init();
+    t->maxE = DONE; // this will change if not actually done
+    t->maxErrorValue = e;
+  }
+
+  // Points of one pooled list come from the same triangle so they
+  // are likely to end up in the same dirty triangle as the previous
+  // point. j is the last triangle a point was found in. Points on an
+  // edge go to the triangle pickTri chooses, as in distrPoints
+  j = 0;
+  for(i = 0; i < tt->swapPoolCount; i++){
+    while((cur = Q_remove_first(tt->swapPool[i])) != NULL) {
+      t = tt->dirtyTris[j];
+      if(ownsPoint2D(t->p1, t->p2, t->p3, &cur->e) <= 0){
+	k = pickTri(tt->dirtyTris,tt->dirtyCount,&cur->e);
+	// Pooled points are always covered by the dirty triangles
+	assert(k >= 0);
+	j = k;
+	t = tt->dirtyTris[j];
+      }
+      Q_insert_qnode_head(t->points,cur);
+      refineStats.pointMoves++;
+      refineStats.swapPointMoves++;
+      tempE = findError(cur->e.x, cur->e.y, cur->e.z, t);
+      // Update max error
+      if (isNewMaxE(tempE,&cur->e,t->maxErrorValue,t->maxE)) {
+	t->maxE = &cur->e;
+	t->maxErrorValue = tempE;
+      }
+    }
+    memFree(MEM_QUEUE, tt->swapPool[i], sizeof(QNODE));
+  }
+  tt->swapPoolCount = 0;
+
+  for(i = 0; i < tt->dirtyCount; i++){
+    t = tt->dirtyTris[i];
+    t->pqIndex = UINT_MAX;
+    if(t->maxE == DONE){
+      Q_free_queue(t->points);
+      t->points = NULL;
+      t->maxErrorValue = 0;
+    }
+    else{
+      assert(triangleInTile(t,tt));
+      PQ_insert(tt->pq,t);
+    }
+    DEBUG{checkPointList(t);}
+  }
+  tt->dirtyCount = 0;
 }
 
 
@@ -771,6 +1379,19 @@ void refineTin(double e, short delaunay, TIN *tin,char *path,
 
   TIN_TILE *tt;
   printf("refining..\n"); fflush(stdout);
+
+  if(refineOpts.progressInterval > 0){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    progress.tin = tin;
+    progress.start = progress.last = tv.tv_sec + tv.tv_usec / 1000000.0;
+    progress.cells = progress.cellsDone = 0;
+    progress.tiles = progress.tilesDone = 0;
+    for(tt = tin->tt->next; tt->next != NULL; tt = tt->next){
+      progress.cells += (long)tt->nrows * tt->ncols;
+      progress.tiles++;
+    }
+  }
   
   // write tin file headers
   if(path != NULL)
@@ -807,20 +1428,38 @@ void refineTin(double e, short delaunay, TIN *tin,char *path,
   // Skip the dummy head
   tt = tin->tt->next;
   while(tt->next != NULL){
+    statsBeginTile();
+    if(traceOn)
+      traceEvent("tile",'B',tt->iOffset,tt->jOffset);
     refineTile(tt,e,delaunay,useNodata);
     tin->numTris += tt->numTris;
     tin->numPoints += tt->numPoints;
 #ifdef __GRASS__
     if(siteFileName != NULL) {
+      TRACE_BEGIN("writeSitesTile");
       writeSitesTile(tt,sitesFile, siteFileName);
       assert(sitesFile);
+      TRACE_END("writeSitesTile");
     }
     if(vectFileName != NULL) {
+      TRACE_BEGIN("writeVectorTile");
       writeVectorTile(&Map,tt);
+      TRACE_END("writeVectorTile");
     }
 #endif
-    if(path != NULL)
+    if(path != NULL){
+      TRACE_BEGIN("writeTinTile");
       writeTinTile(tt,path,1);
+      TRACE_END("writeTinTile");
+    }
+    if(traceOn)
+      traceEvent("tile",'E',tt->iOffset,tt->jOffset);
+    if(refineOpts.progressInterval > 0){
+      progress.tilesDone++;
+      progress.cellsDone += (long)tt->nrows * tt->ncols;
+      reportProgress(NULL,0,0);
+    }
+    statsEndTile(tt->iOffset,tt->jOffset,tt->numTris,tt->numPoints);
     
     // Go to next tile
     tt = tt->next;
@@ -830,6 +1469,8 @@ void refineTin(double e, short delaunay, TIN *tin,char *path,
     tin->numTris += tt->numTris;
     tin->numPoints += tt->numPoints;
   }
+  if(refineOpts.progressInterval > 0)
+    reportProgress(NULL,0,1);
 
 #ifdef __GRASS__
   if (siteFileName != NULL) {
@@ -852,12 +1493,73 @@ void refineTin(double e, short delaunay, TIN *tin,char *path,
 void refineTile(TIN_TILE *tt, double e, short delaunay, short useNodata) {  
   BOOL complete;    // is maxE < e
   complete = 0;
-  TRIANGLE *t1, *t2, *t3, *s;
+  TRIANGLE *s;
 
   int refineCount = 0;
+  int rounds = 0;
+
+  // Create a PQ of the error of the triangles. We want to give the PQ
+  // an initial size which is the lowest power of 2 which will fit all
+  // the triangles in the tile (3 * numPoints in tile)
+  //
+  // If the tile is larger than 4000 then we are probably running
+  // untiled and we should start the pq small and just let it grow as
+  // needed
+  unsigned int initPQSize = 1048576;
+  if(tt->nrows < 4000 && tt->ncols < 4000)
+    initPQSize = (unsigned int)	pow(2,ceil(log10(3.0 * tt->nrows * tt->ncols)
+					   /log10(2)));
+  tt->pq = PQ_initialize( initPQSize );
 
   // Read points for initial two triangles into a file
   initTilePoints(tt,e,useNodata);
+  tt->curveCount = 0;
+  tt->curveMin = ELEV_TYPE_MAX;
+
+  // Swaps only happen when enforcing delaunay
+  if(delaunay){
+    tt->dirtySize = 64;
+    tt->dirtyTris = (TRIANGLE**)malloc(tt->dirtySize * sizeof(TRIANGLE*));
+    assert(tt->dirtyTris);
+    if(refineOpts.lazySwap){
+      tt->swapPoolSize = 64;
+      tt->swapPool = (QUEUE*)malloc(tt->swapPoolSize * sizeof(QUEUE));
+      assert(tt->swapPool);
+    }
+  }
+
+  TRACE_BEGIN("refine");
+
+  // Insert the seed lattice before the greedy refinement
+  if(tt->seeds != NULL)
+    refineCount += seedTile(tt,e,delaunay);
+
+  // Batched refinement, in rounds of independent triangles
+  if(refineOpts.batchSize > 1){
+    BATCH_TRI *round = (BATCH_TRI*)malloc(refineOpts.batchSize * 
+					  sizeof(BATCH_TRI));
+    TRIANGLE **deferred = (TRIANGLE**)malloc(2 * refineOpts.batchSize * 
+					     sizeof(TRIANGLE*));
+    assert(round && deferred);
+    if(delaunay){
+      tt->batchSize = 3 * refineOpts.batchSize;
+      tt->batchTris = (TRIANGLE**)malloc(tt->batchSize * sizeof(TRIANGLE*));
+      tt->batchPts = (R_POINT**)malloc(tt->batchSize * sizeof(R_POINT*));
+      assert(tt->batchTris && tt->batchPts);
+    }
+    while(PQ_min(tt->pq, &s)){
+      if(refineOpts.progressInterval > 0 && ++rounds % PROGRESS_CHECK == 0)
+	reportProgress(tt,s->maxErrorValue,0);
+      refineCount += refineBatch(tt,e,delaunay,round,deferred);
+    }
+    free(round);
+    free(deferred);
+    free(tt->batchTris);
+    free(tt->batchPts);
+    tt->batchTris = NULL;
+    tt->batchPts = NULL;
+    tt->batchSize = 0;
+  }
   
   // While there still is a triangle with max error > e
   while(PQ_extractMin(tt->pq, &s)){
@@ -869,109 +1571,23 @@ void refineTile(TIN_TILE *tt, double e, short delaunay, short useNodata) {
 	     s->maxErrorValue);
       fflush(stdout);
       assert(0);
-      removeTri(s);
+      removeTri(tt,s);
     }
 
     assert(s); 
     refineCount++;
+    if(refineOpts.progressInterval > 0 && refineCount % PROGRESS_CHECK == 0)
+      reportProgress(tt,s->maxErrorValue,0);
 
-    // malloc the point with max error as it will become a corner
-    R_POINT* maxError = (R_POINT*)malloc(sizeof(R_POINT));
-    assert(maxError);	
-    maxError->x = s->maxE->x;
-    maxError->y = s->maxE->y;
-    maxError->z = s->maxE->z;
-
-    // Add point to the correct point pointer array
-    assert(tt->bPointsCount < tt->ncols && 
-	   tt->rPointsCount < tt->nrows && 
-	   tt->bPointsCount < (tt->ncols * tt->nrows)-(tt->ncols + tt->nrows));
-    if(maxError->x == (tt->iOffset + tt->nrows-1) ){
-      tt->bPoints[tt->bPointsCount]=maxError;
-      tt->bPointsCount++;
-    }
-    else if(maxError->y == (tt->jOffset + tt->ncols-1) ){
-      tt->rPoints[tt->rPointsCount]=maxError;
-      tt->rPointsCount++;
-    }
-    else{
-      tt->points[tt->pointsCount]=maxError;
-      tt->pointsCount++;
-    }
-
-    // Debug - print the point being added
-#ifdef REFINE_DEBUG 
-    {
-      TRIANGLE *snext;
-      R_POINT err = findError(s->maxE->x, s->maxE->y, s->maxE->z, s); 
-      printf("Point (%6d,%6d,%6d) error=%10ld \t", 
-	     s->maxE->x, s->maxE->y, s->maxE->z, err );
-      printTriangleCoords(s);
-      fflush(stdout);
-
-      if(err != s->maxErrorValue){
-	printf("Died err= %ld maxE= %ld \n",err,s->maxErrorValue);
-	exit(1);
-      }
-
-      PQ_min(tt->pq, &snext); 
-      assert(s->maxErrorValue >= snext->maxErrorValue); 
-    }
-#endif
-    // Check for collinear points. We make the valid assumption that
-    // MaxE cannot be collinear with > 1 tri
-    int area12,area13,area23;
-
-    area12 = areaSign(s->p1, s->p2, maxError);
-    area13 = areaSign(s->p1, maxError, s->p3);
-    area23 = areaSign(maxError, s->p2, s->p3);
-
-    // If p1 p2 is collinear with MaxE
-    if (!area12){
-      fixCollinear(s->p1,s->p2,s->p3,s,e,maxError,tt,delaunay);
-      tt->numTris++;
-    }
-    else if (!area13){
-      fixCollinear(s->p1,s->p3,s->p2,s,e,maxError,tt,delaunay);
-      tt->numTris++;
-    }
-    else if (!area23){
-      fixCollinear(s->p2,s->p3,s->p1,s,e,maxError,tt,delaunay);
-      tt->numTris++;
-    }
-    else {
-      // add three new triangles
-      t1 = addTri(tt,s->p1, s->p2, maxError,s->p1p2,NULL,NULL);
-      t2 = addTri(tt,s->p1, maxError, s->p3,t1,s->p1p3,NULL);
-      t3 = addTri(tt,maxError, s->p2, s->p3,t1,t2,s->p2p3);
-      DEBUG{triangleCheck(s,t1,t2,t3);}
-
-      tt->numTris += 2;
-
-      // create poinlists from the original tri (this will yeild the max error)
-      distrPoints(t1,t2,t3,s,NULL,e,tt);
-      DEBUG{checkPointList(t1);checkPointList(t2);checkPointList(t3);}  
-
-      // Enforce delaunay on three new edges of the new triangles if
-      // specified
-      if(delaunay){
-	// we enforce on the edge that does not have maxE as an
-	// endpoint, so the 4th argument to enforceDelaunay should
-	// always be the maxE point to s for that particular tri
-	enforceDelaunay(t1,t1->p1,t1->p2,t1->p3,e,tt);
-	enforceDelaunay(t2,t2->p1,t2->p3,t2->p2,e,tt);
-	enforceDelaunay(t3,t3->p2,t3->p3,t3->p1,e,tt);
-      }
-    }
-    
-    // remove original tri
-    removeTri(s);
-    //DEBUG{printTin(tt);}
+    if(curvePoints != NULL)
+      recordCurvePoint(tt,s->maxErrorValue);
+    insertMaxErrorPoint(tt,s,e,delaunay);
 
     extern int displayValid;
     displayValid = 0;
 
   } 
+  TRACE_END("refine");
   s = tt->t;
  
   // The number of points added is equal to the number of refine loops
@@ -988,14 +1604,689 @@ void refineTile(TIN_TILE *tt, double e, short delaunay, short useNodata) {
     pts += tt->left->rPointsCount - 2;
   //assert(tt->numPoints == pts); fix
 
-  // Sort the point arrays for future use and binary searching
-  qsort(tt->rPoints,tt->rPointsCount,sizeof(R_POINT*),(void *)QS_compPoints);
-  qsort(tt->bPoints,tt->bPointsCount,sizeof(R_POINT*),(void *)QS_compPoints);
-  qsort(tt->points,tt->pointsCount,sizeof(R_POINT*),(void *)QS_compPoints);
+  // Sort the point arrays for future use and index the points for
+  // output
+  TRACE_BEGIN("sortTilePoints");
+  sortTilePoints(tt);
+  TRACE_END("sortTilePoints");
 
   // We are done with the pq
   PQ_free(tt->pq);
+  tt->pq = NULL;
+
+  if(tt->dirtyTris != NULL){
+    assert(tt->dirtyCount == 0 && tt->swapPoolCount == 0);
+    free(tt->swapPool);
+    free(tt->dirtyTris);
+    tt->swapPool = NULL;
+    tt->dirtyTris = NULL;
+  }
+
+  if(curvePoints != NULL)
+    endCurveTile(tt);
+}
+
+
+//
+// Print a progress report to stderr if refineOpts.progressInterval
+// seconds have passed since the last one, or if force is set. tt is
+// the tile being refined with max error maxErr, or NULL between
+// tiles. The report is one line of key=value pairs; the ETA assumes
+// the cells left go at the rate of the tiles done
+//
+void reportProgress(TIN_TILE *tt, ELEV_TYPE maxErr, short force){
+  struct timeval tv;
+  double now, elapsed, rate, eta = -1;
+
+  gettimeofday(&tv, NULL);
+  now = tv.tv_sec + tv.tv_usec / 1000000.0;
+  if(!force && now - progress.last < refineOpts.progressInterval)
+    return;
+  progress.last = now;
+
+  elapsed = now - progress.start;
+  rate = elapsed > 0 ? progress.cellsDone / elapsed : 0;
+  if(rate > 0)
+    eta = (progress.cells - progress.cellsDone) / rate;
+  // ELEV_TYPE_PRINT_CHAR is a string literal, it is joined to the
+  // format at compile time
+  fprintf(stderr, "progress: tiles=%u/%u cells=%ld/%ld cells_per_s=%.0f "
+	  "triangles=%u pq=%u max_error=" ELEV_TYPE_PRINT_CHAR 
+	  " elapsed=%.1f eta=%.1f\n",
+	  progress.tilesDone, progress.tiles, progress.cellsDone,
+	  progress.cells, rate, 
+	  progress.tin->numTris + (tt != NULL ? tt->numTris : 0),
+	  tt != NULL ? PQ_size(tt->pq) : 0, maxErr, elapsed, eta);
+  fflush(stderr);
+}
+
+
+//
+// Start recording the convergence curve
+//
+void initCurve(){
+  curvePoints = (unsigned long*)calloc(ELEV_TYPE_MAX + 1, 
+				       sizeof(unsigned long));
+  assert(curvePoints);
+  curveInserted = 0;
+}
+
+
+//
+// Convergence curve: record the insertion of a point of error err in
+// tile tt. Points are inserted while the max error is at least the
+// error of the refinement, so with error E the tile stops before the
+// first point of error below E. Each time the smallest error so far
+// drops, the errors it passed stop at the points inserted so far
+//
+void recordCurvePoint(TIN_TILE *tt, ELEV_TYPE err){
+  int i;
+
+  if(err < tt->curveMin){
+    for(i = err + 1; i <= tt->curveMin; i++)
+      curvePoints[i] += tt->curveCount;
+    tt->curveMin = err;
+  }
+  tt->curveCount++;
+}
+
+
+//
+// Convergence curve: record the insertion of a seed of error err. The
+// seeds are not inserted in order of error, a run with error E would
+// insert the seeds of error E or more, so each seed only counts for
+// the errors up to its own
+//
+void recordCurveSeed(ELEV_TYPE err){
+  int i;
+
+  for(i = 0; i <= err; i++)
+    curvePoints[i]++;
+  curveInserted++;
+}
+
+
+//
+// Convergence curve: add the points inserted in tile tt to the
+// errors not reached in the tile
+//
+void endCurveTile(TIN_TILE *tt){
+  int i;
+
+  for(i = 0; i <= tt->curveMin; i++)
+    curvePoints[i] += tt->curveCount;
+  curveInserted += tt->curveCount;
+}
+
+
+//
+// Write the convergence curve of tin refined with error e to a CSV
+// file, from the largest error down to e. The points of the TIN that
+// were not inserted (the corners of the tiles) are added to the
+// counts so the last line matches the TIN
+//
+void writeCurve(char *path, TIN *tin, double e){
+  FILE *fp;
+  int i, lo = (ELEV_TYPE)e;
+  long base = (long)tin->numPoints - curveInserted;
+  double range = tin->max - tin->min;
+
+  assert(curvePoints);
+  if((fp = fopen(path, "w")) == NULL){
+    fprintf(stderr, "writeCurve: can't write to %s ",path);
+    perror("writeCurve:");
+    exit(1);
+  }
+
+  // Only the ends of the steps of the curve, and the error of the run
+  fprintf(fp, "epsilon,absError,points\n");
+  for(i = ELEV_TYPE_MAX; i >= lo; i--){
+    if(i > lo && (i == ELEV_TYPE_MAX || curvePoints[i] == curvePoints[i+1]) &&
+       curvePoints[i] == curvePoints[i-1])
+      continue;
+    fprintf(fp, "%.4f,%d,%ld\n", range > 0 ? 100.0 * i / range : 0.0, 
+	    i, base + (long)curvePoints[i]);
+  }
+  fclose(fp);
+}
+
+
+//
+// Seeding: keep p as the seed of its block if its error is the
+// largest so far. Only points inside the tile are seeded
+//
+void updateSeed(TIN_TILE *tt, int row, int col, R_POINT *p, 
+		ELEV_TYPE err){
+  if(row == 0 || col == 0 || row == tt->nrows-1 || col == tt->ncols-1)
+    return;
+
+  unsigned int i = (row / refineOpts.seedSpacing) * tt->seedCols + 
+    col / refineOpts.seedSpacing;
+  if(err > tt->seedErr[i]){
+    tt->seedErr[i] = err;
+    tt->seeds[i] = *p;
+  }
+}
+
+
+//
+// Find the triangle containing point p by walking from triangle t
+// towards p. Returns NULL if not found in maxSteps steps
+//
+TRIANGLE *locateTriangle(TRIANGLE *t, R_POINT *p, unsigned int maxSteps){
+  unsigned int steps;
+
+  // Cross the first edge which has p and the third point of t on
+  // different sides
+  for(steps = 0; t != NULL && steps < maxSteps; steps++){
+    if(areaSign(t->p1,t->p2,p) * areaSign(t->p1,t->p2,t->p3) < 0)
+      t = t->p1p2;
+    else if(areaSign(t->p1,t->p3,p) * areaSign(t->p1,t->p3,t->p2) < 0)
+      t = t->p1p3;
+    else if(areaSign(t->p2,t->p3,p) * areaSign(t->p2,t->p3,t->p1) < 0)
+      t = t->p2p3;
+    else
+      return t;
+  }
+  return NULL;
+}
+
 
+//
+// Seeding: insert the seed of every block whose error is at least e
+// before the greedy refinement starts, so that the first point lists
+// to distribute are small. Returns the number of points inserted
+//
+unsigned int seedTile(TIN_TILE *tt, double e, short delaunay){
+  assert(tt->seeds && tt->seedErr);
+
+  unsigned int i, count = 0;
+  TRIANGLE *s;
+  R_POINT *p;
+  ELEV_TYPE err;
+
+  for(i = 0; i < tt->seedRows * tt->seedCols; i++){
+    if(tt->seedErr[i] < (ELEV_TYPE)e)
+      continue;
+    p = &tt->seeds[i];
+
+    // The lower left triangle always exists, walk from there
+    s = locateTriangle(tt->t,p,tt->numTris);
+
+    // Skip seeds in done triangles, they are within e now. Points on
+    // an edge may be in the point list of the other triangle so they
+    // are skipped too
+    if(s == NULL || s->maxE == DONE || s->maxE == NULL ||
+       !areaSign(s->p1,s->p2,p) || !areaSign(s->p1,s->p3,p) || 
+       !areaSign(s->p2,s->p3,p))
+      continue;
+
+    // seedErr is the error in the initial triangles, the seed is
+    // inserted at its error in s. Seeds within e in s are skipped
+    err = findError(p->x,p->y,p->z,s);
+    if(err < (ELEV_TYPE)e)
+      continue;
+
+    PQ_delete(tt->pq,s->pqIndex);
+    s->maxE = p;
+    s->maxErrorValue = err;
+    if(curvePoints != NULL)
+      recordCurveSeed(err);
+    insertMaxErrorPoint(tt,s,e,delaunay);
+    count++;
+  }
+
+  memFree(MEM_BUF, tt->seeds, tt->seedRows * tt->seedCols * sizeof(R_POINT));
+  memFree(MEM_BUF, tt->seedErr, 
+	  tt->seedRows * tt->seedCols * sizeof(ELEV_TYPE));
+  tt->seeds = NULL;
+  tt->seedErr = NULL;
+  return count;
+}
+
+
+//
+// Batched refinement: take up to refineOpts.batchSize triangles with
+// error close to the max error and whose neighbourhoods don't overlap
+// from the PQ, split them at their max error points and distribute
+// their points in parallel, then enforce Delaunay around the new
+// points. round is scratch space for batchSize triangles and deferred
+// for 2*batchSize. Returns the number of points inserted
+//
+unsigned int refineBatch(TIN_TILE *tt, double e, short delaunay, 
+			 BATCH_TRI *round, TRIANGLE **deferred){
+  unsigned int i, k, n = 0, numDeferred = 0, size = refineOpts.batchSize;
+  ELEV_TYPE bound;
+  TRIANGLE *s, *t;
+  R_POINT *p;
+  BATCH_TRI *b;
+
+  if(!PQ_min(tt->pq,&s))
+    return 0;
+  bound = s->maxErrorValue * BATCH_ERROR_FACTOR;
+
+  // Take the triangles in order of error. The ones next to a triangle
+  // already in the round wait for a later round. A max error point on
+  // an edge also splits the triangle across the edge, so its triangle
+  // waits too, or is inserted in a round of its own if it is first
+  while(n < size && numDeferred < 2 * size && 
+	PQ_min(tt->pq,&s) && s->maxErrorValue >= bound){
+    PQ_extractMin(tt->pq,&s);
+    if(!areaSign(s->p1,s->p2,s->maxE) || !areaSign(s->p1,s->maxE,s->p3) ||
+       !areaSign(s->maxE,s->p2,s->p3)){
+      if(n == 0 && numDeferred == 0){
+	if(curvePoints != NULL)
+	  recordCurvePoint(tt,s->maxErrorValue);
+	insertMaxErrorPoint(tt,s,e,delaunay);
+	return 1;
+      }
+      deferred[numDeferred++] = s;
+      continue;
+    }
+    if(batchIndependent(round,n,s))
+      round[n++].s = s;
+    else
+      deferred[numDeferred++] = s;
+  }
+  for(i = 0; i < numDeferred; i++)
+    PQ_insert(tt->pq,deferred[i]);
+
+  // Split the triangles of the round at their max error points
+  for(i = 0; i < n; i++){
+    b = &round[i];
+    s = b->s;
+    if(curvePoints != NULL)
+      recordCurvePoint(tt,s->maxErrorValue);
+    b->p = addMaxErrorPoint(tt,s);
+    b->t[0] = addTri(tt,s->p1, s->p2, b->p,s->p1p2,NULL,NULL);
+    b->t[1] = addTri(tt,s->p1, b->p, s->p3,b->t[0],s->p1p3,NULL);
+    b->t[2] = addTri(tt,b->p, s->p2, s->p3,b->t[0],b->t[1],s->p2p3);
+    DEBUG{triangleCheck(s,b->t[0],b->t[1],b->t[2]);}
+    tt->numTris += 2;
+    for(k = 0; k < 3; k++){
+      b->t[k]->points = Q_init();
+      b->t[k]->maxE = DONE; // this will change if not actually done
+    }
+    if(s == tt->t)
+      updateTinTileCorner(tt,b->t[0],b->t[1],b->t[2]);
+  }
+
+  distrBatch(tt,round,n,e);
+
+  // Insert the new triangles in the PQ and remove the split ones
+  for(i = 0; i < n; i++){
+    b = &round[i];
+    for(k = 0; k < 3; k++){
+      DEBUG{checkPointList(b->t[k]);}
+      finishDistrTri(b->t[k],tt);
+      if(delaunay)
+	addBatchEdge(tt,b->t[k],b->p);
+    }
+    removeTri(tt,b->s);
+  }
+
+  // Enforce Delaunay on the edges opposite the new points. The
+  // cascade of one edge may swap the triangle of an edge still to
+  // check, swapBatchEdges then moves the edge to the new triangles
+  while(tt->batchCount > 0){
+    tt->batchCount--;
+    t = tt->batchTris[tt->batchCount];
+    p = tt->batchPts[tt->batchCount];
+    if(t->p1 == p)
+      enforceDelaunay(t,t->p2,t->p3,p,e,tt);
+    else if(t->p2 == p)
+      enforceDelaunay(t,t->p1,t->p3,p,e,tt);
+    else
+      enforceDelaunay(t,t->p1,t->p2,p,e,tt);
+
+    // The cascade for this edge is done, give the dirty triangles
+    // their points
+    if(tt->dirtyCount > 0)
+      flushSwapPoints(tt,e);
+  }
+
+  extern int displayValid;
+  displayValid = 0;
+  return n;
+}
+
+
+//
+// Returns 1 if t and the first n triangles of round share no
+// triangle or neighbor else 0
+//
+short batchIndependent(BATCH_TRI *round, unsigned int n, TRIANGLE *t){
+  unsigned int i, j, k;
+  TRIANGLE *b, *tn[4], *bn[4];
+
+  tn[0] = t;
+  tn[1] = t->p1p2;
+  tn[2] = t->p1p3;
+  tn[3] = t->p2p3;
+  for(i = 0; i < n; i++){
+    b = round[i].s;
+    bn[0] = b;
+    bn[1] = b->p1p2;
+    bn[2] = b->p1p3;
+    bn[3] = b->p2p3;
+    for(j = 0; j < 4; j++)
+      for(k = 0; k < 4; k++)
+	if(tn[j] != NULL && tn[j] == bn[k])
+	  return 0;
+  }
+  return 1;
+}
+
+
+//
+// Distribute the points of the triangles of a batched round to their
+// new triangles, using refineOpts.distrThreads threads if there are
+// enough points
+//
+void distrBatch(TIN_TILE *tt, BATCH_TRI *round, unsigned int n, double e){
+  unsigned int i, next = 0;
+  int nthreads = 1;
+  double area, total = 0;
+  BATCH_TRI *b;
+  QNODE *cur, *nextNode;
+
+  // Very large point lists are split between threads as in
+  // distrPoints, the others go to the threads whole
+  for(i = 0; i < n; i++){
+    b = &round[i];
+    b->skip = NULL;
+    b->moves = 0;
+    area = triangleArea(b->s);
+    if(refineOpts.distrThreads > 1 && area >= DISTR_PARALLEL_MIN)
+      distrPointsParallel(b->t,b->s,NULL,e,tt);
+    else
+      total += area;
+  }
+  if(refineOpts.distrThreads > 1 && total >= BATCH_PARALLEL_MIN)
+    nthreads = MIN(refineOpts.distrThreads, n);
+
+  BATCH_CHUNK *chunks = (BATCH_CHUNK*)malloc(nthreads * sizeof(BATCH_CHUNK));
+  pthread_t *threads = (pthread_t*)malloc(nthreads * sizeof(pthread_t));
+  assert(chunks && threads);
+
+  for(i = 0; i < nthreads; i++){
+    chunks[i].tris = round;
+    chunks[i].n = n;
+    chunks[i].next = &next;
+    chunks[i].e = e;
+    chunks[i].nodata = tt->nodata;
+    chunks[i].worker = nthreads == 1 ? -1 : i;
+    if(nthreads == 1)
+      distrBatchChunk(&chunks[i]);
+    else if(pthread_create(&threads[i], NULL, distrBatchChunk, &chunks[i])){
+      printf("distrBatch: cannot create thread\n");
+      exit(1);
+    }
+  }
+  if(nthreads > 1)
+    for(i = 0; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+
+  // The lists of the split triangles are empty, free them with the
+  // points that were not moved
+  for(i = 0; i < n; i++){
+    b = &round[i];
+    for(cur = b->skip; cur != NULL; cur = nextNode){
+      nextNode = cur->next;
+      memFree(MEM_QUEUE, cur, sizeof(QNODE));
+    }
+    if(b->s->points != NULL){
+      Q_free_queue(b->s->points);
+      b->s->points = NULL;
+    }
+    refineStats.pointMoves += b->moves;
+  }
+
+  free(threads);
+  free(chunks);
+}
+
+
+//
+// Thread function of distrBatch, arg is a BATCH_CHUNK
+//
+void *distrBatchChunk(void *arg){
+  BATCH_CHUNK *c = (BATCH_CHUNK*)arg;
+  BATCH_TRI *b;
+  TRIANGLE *s;
+  QNODE *cur;
+  ELEV_TYPE max[3], tempE;
+  unsigned int i;
+  int k;
+  short skippedMax;
+
+  if(c->worker >= 0)
+    traceThread(c->worker);
+  TRACE_BEGIN("distrBatchChunk");
+  while((i = __sync_fetch_and_add(c->next,1)) < c->n){
+    b = &c->tris[i];
+    s = b->s;
+    // Already distributed by distrPointsParallel
+    if(s->points == NULL)
+      continue;
+
+    STATS_START(STAT_DISTR_POINTS);
+    for(k = 0; k < 3; k++)
+      max[k] = c->e;
+    skippedMax = 0;
+    while((cur = Q_remove_first(s->points)) != NULL){
+      assert(inTri2D(s->p1, s->p2, s->p3, &cur->e));
+
+      // The max error point of s is now a corner of the new triangles
+      if(!skippedMax && cur->e.x == s->maxE->x && cur->e.y == s->maxE->y){
+	skippedMax = 1;
+	cur->next = b->skip;
+	b->skip = cur;
+	continue;
+      }
+
+      k = pickTri(b->t,3,&cur->e);
+
+      //should never get here if point is not nodata
+      if(k < 0){
+	if(cur->e.z != c->nodata){
+	  assert(0);
+	  exit(1);
+	}
+	cur->next = b->skip;
+	b->skip = cur;
+	continue;
+      }
+
+      Q_insert_qnode_head(b->t[k]->points,cur);
+      b->moves++;
+      tempE = findError(cur->e.x, cur->e.y, cur->e.z, b->t[k]);
+      if(isNewMaxE(tempE,&cur->e,max[k],b->t[k]->maxE)){
+	max[k] = tempE;
+	b->t[k]->maxE = &cur->e;
+	b->t[k]->maxErrorValue = tempE;
+      }
+    }
+    STATS_STOP(STAT_DISTR_POINTS);
+  }
+  TRACE_END("distrBatchChunk");
+  if(c->worker >= 0)
+    statsFlushThread();
+  return NULL;
+}
+
+
+//
+// Batched refinement: the edge opposite p in t is still to be checked
+// for Delaunay
+//
+void addBatchEdge(TIN_TILE *tt, TRIANGLE *t, R_POINT *p){
+  assert(tt->batchTris && isEndPoint(t,p));
+
+  if(tt->batchCount == tt->batchSize){
+    tt->batchSize *= 2;
+    tt->batchTris = (TRIANGLE**)realloc(tt->batchTris, 
+					tt->batchSize * sizeof(TRIANGLE*));
+    tt->batchPts = (R_POINT**)realloc(tt->batchPts, 
+				      tt->batchSize * sizeof(R_POINT*));
+    assert(tt->batchTris && tt->batchPts);
+  }
+  tt->batchTris[tt->batchCount] = t;
+  tt->batchPts[tt->batchCount] = p;
+  tt->batchCount++;
+}
+
+
+//
+// Batched refinement: called by edgeSwap before t1 and t2 are replaced
+// by tn1 and tn2. The edges still to be checked in t1 and t2 move to
+// the new triangles with the same point
+//
+void swapBatchEdges(TIN_TILE *tt, TRIANGLE *t1, TRIANGLE *t2,
+		    TRIANGLE *tn1, TRIANGLE *tn2){
+  unsigned int i, n = tt->batchCount;
+  R_POINT *p;
+
+  for(i = 0; i < n; i++){
+    if(tt->batchTris[i] != t1 && tt->batchTris[i] != t2)
+      continue;
+    // p is a corner of one of the new triangles, or of both if it is
+    // not on the swapped edge
+    p = tt->batchPts[i];
+    if(isEndPoint(tn1,p)){
+      tt->batchTris[i] = tn1;
+      if(isEndPoint(tn2,p))
+	addBatchEdge(tt,tn2,p);
+    }
+    else{
+      assert(isEndPoint(tn2,p));
+      tt->batchTris[i] = tn2;
+    }
+  }
+}
+
+
+//
+// Copy the max error point of s, which becomes a corner, into the
+// point arrays of tile tt and return the copy
+//
+R_POINT *addMaxErrorPoint(TIN_TILE *tt, TRIANGLE *s){
+  // Points on the last row or column are shared with the next tiles
+  // and outlive this one so they are malloced, interior points come
+  // from the vertex pool of the tile
+  R_POINT* maxError;
+
+  // Add point to the correct point pointer array
+  if(s->maxE->x == (tt->iOffset + tt->nrows-1) ){
+    assert(tt->bPointsCount < tt->bPointsSize);
+    maxError = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
+    tt->bPoints[tt->bPointsCount]=maxError;
+    tt->bPointsCount++;
+  }
+  else if(s->maxE->y == (tt->jOffset + tt->ncols-1) ){
+    assert(tt->rPointsCount < tt->rPointsSize);
+    maxError = (R_POINT*)memAlloc(MEM_POINTS, sizeof(R_POINT));
+    tt->rPoints[tt->rPointsCount]=maxError;
+    tt->rPointsCount++;
+  }
+  else{
+    assert(tt->pointsCount < tt->pointsSize);
+    maxError = allocVertex(tt);
+    tt->points[tt->pointsCount]=maxError;
+    tt->pointsCount++;
+  }
+  assert(maxError);	
+  maxError->x = s->maxE->x;
+  maxError->y = s->maxE->y;
+  maxError->z = s->maxE->z;
+  return maxError;
+}
+
+
+//
+// Insert the max error point of s (s->maxE) into the triangulation of
+// tile tt. s must already be out of the PQ, it is split and removed
+//
+void insertMaxErrorPoint(TIN_TILE *tt, TRIANGLE *s, double e, 
+			 short delaunay){
+  TRIANGLE *t1, *t2, *t3;
+
+  // Copy the point with max error as it will become a corner
+  R_POINT* maxError = addMaxErrorPoint(tt,s);
+
+  // Debug - print the point being added
+#ifdef REFINE_DEBUG 
+  {
+    TRIANGLE *snext;
+    R_POINT err = findError(s->maxE->x, s->maxE->y, s->maxE->z, s); 
+    printf("Point (%6d,%6d,%6d) error=%10ld \t", 
+	   s->maxE->x, s->maxE->y, s->maxE->z, err );
+    printTriangleCoords(s);
+    fflush(stdout);
+
+    if(err != s->maxErrorValue){
+      printf("Died err= %ld maxE= %ld \n",err,s->maxErrorValue);
+      exit(1);
+    }
+
+    PQ_min(tt->pq, &snext); 
+    assert(s->maxErrorValue >= snext->maxErrorValue); 
+  }
+#endif
+  // Check for collinear points. We make the valid assumption that
+  // MaxE cannot be collinear with > 1 tri
+  int area12,area13,area23;
+
+  area12 = areaSign(s->p1, s->p2, maxError);
+  area13 = areaSign(s->p1, maxError, s->p3);
+  area23 = areaSign(maxError, s->p2, s->p3);
+
+  // If p1 p2 is collinear with MaxE
+  if (!area12){
+    fixCollinear(s->p1,s->p2,s->p3,s,e,maxError,tt,delaunay);
+    tt->numTris++;
+  }
+  else if (!area13){
+    fixCollinear(s->p1,s->p3,s->p2,s,e,maxError,tt,delaunay);
+    tt->numTris++;
+  }
+  else if (!area23){
+    fixCollinear(s->p2,s->p3,s->p1,s,e,maxError,tt,delaunay);
+    tt->numTris++;
+  }
+  else {
+    // add three new triangles
+    t1 = addTri(tt,s->p1, s->p2, maxError,s->p1p2,NULL,NULL);
+    t2 = addTri(tt,s->p1, maxError, s->p3,t1,s->p1p3,NULL);
+    t3 = addTri(tt,maxError, s->p2, s->p3,t1,t2,s->p2p3);
+    DEBUG{triangleCheck(s,t1,t2,t3);}
+
+    tt->numTris += 2;
+
+    // create poinlists from the original tri (this will yeild the max error)
+    distrPoints(t1,t2,t3,s,NULL,e,tt);
+    DEBUG{checkPointList(t1);checkPointList(t2);checkPointList(t3);}  
+
+    // Enforce delaunay on three new edges of the new triangles if
+    // specified
+    if(delaunay){
+      // we enforce on the edge that does not have maxE as an
+      // endpoint, so the 4th argument to enforceDelaunay should
+      // always be the maxE point to s for that particular tri
+      enforceDelaunay(t1,t1->p1,t1->p2,t1->p3,e,tt);
+      enforceDelaunay(t2,t2->p1,t2->p3,t2->p2,e,tt);
+      enforceDelaunay(t3,t3->p2,t3->p3,t3->p1,e,tt);
+    }
+  }
+
+  // remove original tri
+  removeTri(tt,s);
+  //DEBUG{printTin(tt);}
+
+  // The cascade for this point is done, give the dirty triangles
+  // their points
+  if(tt->dirtyCount > 0)
+    flushSwapPoints(tt,e);
 }
 
 
@@ -1005,6 +2296,7 @@ void refineTile(TIN_TILE *tt, double e, short delaunay, short useNodata) {
 //
 void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
 		  R_POINT *maxError, TIN_TILE *tt, short delaunay){
+  STATS_START(STAT_FIX_COLLINEAR);
 
   assert(s && tt->pq && maxError);
   TRIANGLE *sp, *t1, *t2, *t3, *t4;
@@ -1057,11 +2349,11 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
     //points in it's point list > MaxE then we don't distribute points
     //because sp has no point list
     if(sp->maxE != DONE){
-      distrPoints(t3,t4,NULL,sp,NULL,e,ttn);
       //Mark triangle sp for deletion from pq before distrpoints so we
       //can include its maxE in the newly created triangle
       sp->p1p2 = sp->p1p3 = sp->p2p3 = NULL;
       PQ_delete(ttn->pq,sp->pqIndex);
+      distrPoints(t3,t4,NULL,sp,NULL,e,ttn);
     }
     else{
       // Since distrpoints normally fixes corner we need to do it here
@@ -1074,7 +2366,7 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
     DEBUG{checkPointList(t3); checkPointList(t4);}
     
     
-    removeTri(sp);
+    removeTri(ttn,sp);
     
 
     // Enforce delaunay on two new edges of the new triangles if
@@ -1102,6 +2394,7 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
       enforceDelaunay(t2,t2->p2,t2->p3,t2->p1,e,tt);
     }
   }
+  STATS_STOP(STAT_FIX_COLLINEAR);
 }
 
 
@@ -1114,6 +2407,7 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
 //
  void distrPoints(TRIANGLE* t1, TRIANGLE* t2, TRIANGLE* t3, TRIANGLE* s, 
 		  TRIANGLE* sp, double e, TIN_TILE *tt) {
+  STATS_START(STAT_DISTR_POINTS);
 
   //at most one can be null
   assert((t1 && t2) || (t1 && t3) || (t2 && t3));
@@ -1134,6 +2428,13 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
   register QNODE* cur;
   h = s->points;
 
+  // The new triangles, a point goes to the one pickTri chooses
+  TRIANGLE *nt[3];
+  int k;
+  nt[0] = t1;
+  nt[1] = t2;
+  nt[2] = t3;
+
 
 
   // Add a queue of points for each triangle that is not NULL and that
@@ -1153,13 +2454,28 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
      
   int doneDistr = 0;
   
-  // Have we seen only nodata points?
-  short hasNoData1 = 0;
-  short hasNoData2 = 0;
-  short hasNoData3 = 0;
-
   short pointAdded = 0;    
 
+  // Has the maxE node of s been skipped? It is freed then, so s->maxE
+  // must not be read again
+  short skippedMax = 0;
+
+  // Very large point lists are split between threads. The number of
+  // points is about the area of s and sp
+  if(refineOpts.distrThreads > 1){
+    double area = triangleArea(s);
+    if(sp != NULL)
+      area += triangleArea(sp);
+    if(area >= DISTR_PARALLEL_MIN){
+      if(s == tt->t)
+	updateTinTileCorner(tt,t1,t2,t3);    
+      if(sp != NULL && sp == tt->t)
+	updateTinTileCorner(tt,t1,t2,t3);    
+      distrPointsParallel(nt,s,sp,e,tt);
+      doneDistr = 1;
+    }
+  }
+
   // Build point list from s and sp also update lower left corner if nessesary
   while(doneDistr == 0){
 
@@ -1180,59 +2496,60 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
       // skip the point with the maxE if this triangle is not marked for
       // deletion. If it is marked for deletion then it needs to be
       // added to one of the triangles being created
-      if(&cur->e == s->maxE && 
+      if(!skippedMax && cur->e.x == s->maxE->x && cur->e.y == s->maxE->y && 
 	 !(s->p1p2 == NULL && s->p1p3 == NULL && s->p2p3 == NULL)){
-	free(cur);
+	skippedMax = 1;
+	memFree(MEM_QUEUE, cur, sizeof(QNODE));
 	continue;
       } 
 
+      // The new triangle that owns the point
+      k = pickTri(nt,3,&cur->e);
+
       // Triangle 1
-      if(t1 != NULL){
-	if(inTri2D(t1->p1, t1->p2, t1->p3, &cur->e)) {
-	  // Add point to point list
-	  Q_insert_qnode_head(t1->points,cur);
-	  pointAdded = 1;
-	  // Don't calc maxE for nodata points
-	  tempE = findError(cur->e.x, cur->e.y, cur->e.z, t1);
-	  // Update max error
-	  if (tempE>=max1) {
-	    max1 = tempE;
-	    t1->maxE = &cur->e;
-	    t1->maxErrorValue = tempE;
-	  }
-	  continue;
+      if(k == 0){
+	// Add point to point list
+	Q_insert_qnode_head(t1->points,cur);
+	refineStats.pointMoves++;
+	pointAdded = 1;
+	// Don't calc maxE for nodata points
+	tempE = findError(cur->e.x, cur->e.y, cur->e.z, t1);
+	// Update max error
+	if (isNewMaxE(tempE,&cur->e,max1,t1->maxE)) {
+	  max1 = tempE;
+	  t1->maxE = &cur->e;
+	  t1->maxErrorValue = tempE;
 	}
+	continue;
       }
 
       // Triangle 2
-      if(t2 != NULL){
-	if(inTri2D(t2->p1, t2->p2, t2->p3, &cur->e)) {
-	  // Don't calc maxE for nodata points
-	  Q_insert_qnode_head(t2->points,cur);
-	  tempE = findError(cur->e.x, cur->e.y, cur->e.z, t2);
-	  //Update max error
-	  if (tempE>=max2) {
-	    max2 = tempE;
-	    t2->maxE = &cur->e;
-	    t2->maxErrorValue = tempE;
-	  }
-	  continue;
+      if(k == 1){
+	// Don't calc maxE for nodata points
+	Q_insert_qnode_head(t2->points,cur);
+	refineStats.pointMoves++;
+	tempE = findError(cur->e.x, cur->e.y, cur->e.z, t2);
+	//Update max error
+	if (isNewMaxE(tempE,&cur->e,max2,t2->maxE)) {
+	  max2 = tempE;
+	  t2->maxE = &cur->e;
+	  t2->maxErrorValue = tempE;
 	}
+	continue;
       }
 
       // Triangle 3
-      if(t3 != NULL){
-	if(inTri2D(t3->p1, t3->p2, t3->p3, &cur->e)){ 
-	  Q_insert_qnode_head(t3->points,cur);
-	  tempE = findError(cur->e.x, cur->e.y, cur->e.z, t3);
-	  // Update max error
-	  if (tempE>=max3) {
-	    max3 = tempE;
-	    t3->maxE = &cur->e;
-	    t3->maxErrorValue = tempE;
-	  }  
-	  continue;
-	}
+      if(k == 2){
+	Q_insert_qnode_head(t3->points,cur);
+	refineStats.pointMoves++;
+	tempE = findError(cur->e.x, cur->e.y, cur->e.z, t3);
+	// Update max error
+	if (isNewMaxE(tempE,&cur->e,max3,t3->maxE)) {
+	  max3 = tempE;
+	  t3->maxE = &cur->e;
+	  t3->maxErrorValue = tempE;
+	}  
+	continue;
       }
 
       //should never get here if point is not nodata
@@ -1240,14 +2557,20 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
 	assert(0);
 	exit(1);
       }
+      memFree(MEM_QUEUE, cur, sizeof(QNODE));
 
     }//while
 
+    // The list of s is empty, free its head
+    Q_free_queue(s->points);
+    s->points = NULL;
+
     // If we have an sp, go through and distribute points for sp
     if(sp != NULL){
       s = sp;
       h = s->points;
       sp = NULL;
+      skippedMax = 0;
     }
     // No sp? then we are done distributing the points
     else
@@ -1256,63 +2579,198 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s, double e,
   }//while
 
   // Free any unused point lists
-  if(t1 != NULL && t1->maxE == DONE){
-    // If all the points in t1 are nodata and there are points in t1
-    // then this triangle should be marked to not be drawn
-    if(hasNoData1){
-      //allNoData1 == 1 && Q_first(t1->points) != NULL
-      Q_free_queue(t1->points);
-      t1->points = NULL;
-      t1->maxErrorValue = 0;
-    }
+  if(t1 != NULL)
+    finishDistrTri(t1,tt);
+  if(t2 != NULL)
+    finishDistrTri(t2,tt);
+  if(t3 != NULL)
+    finishDistrTri(t3,tt);
+  STATS_STOP(STAT_DISTR_POINTS);
+}
+
+
+//
+// Last step of a point distribution: insert new triangle t in the PQ,
+// or free its point list if it is done
+//
+void finishDistrTri(TRIANGLE *t, TIN_TILE *tt){
+  if(t->maxE == DONE){
+    // The done triangles of an edge swap keep their points until the
+    // Delaunay cascade is done, a later swap may need them
+    if(tt->swapping && Q_first(t->points) != NULL)
+      addDirty(t,tt);
     else{
-      Q_free_queue(t1->points);
-      t1->points = NULL;
-      t1->maxErrorValue = 0;
+      Q_free_queue(t->points);
+      t->points = NULL;
+      t->maxErrorValue = 0;
     }
   }
-  else if(t1 != NULL){
-    assert(triangleInTile(t1,tt));
-    PQ_insert(tt->pq,t1);
+  else{
+    assert(triangleInTile(t,tt));
+    PQ_insert(tt->pq,t);
   }
+}
 
-  if(t2 != NULL && t2->maxE == DONE){
-    // If all the points in t1 are nodata and there are points in t1
-    // then this triangle should be marked to not be drawn
-    if(hasNoData2){
-      Q_free_queue(t2->points);
-      t2->points = NULL;
-      t2->maxErrorValue = 0;
-    }
-    else{
-      Q_free_queue(t2->points);
-      t2->points = NULL;
-      t2->maxErrorValue = 0;
+
+//
+// Distribute the points of s and sp into the new triangles t using
+// refineOpts.distrThreads threads. The point lists and max errors are
+// the same as the ones of the serial distribution
+//
+void distrPointsParallel(TRIANGLE* t[3], TRIANGLE* s, TRIANGLE* sp, 
+			 double e, TIN_TILE *tt){
+  unsigned int n = 0, size = 1024, split, i, k;
+  int nthreads = refineOpts.distrThreads;
+  QNODE **nodes, *cur, *next;
+
+  // Take the points out of s and sp into an array so that they can be
+  // split in chunks
+  nodes = (QNODE**)malloc(size * sizeof(QNODE*));
+  assert(nodes);
+  while((cur = Q_remove_first(s->points)) != NULL){
+    if(n == size){
+      size *= 2;
+      nodes = (QNODE**)realloc(nodes, size * sizeof(QNODE*));
+      assert(nodes);
     }
+    nodes[n++] = cur;
   }
-  else if(t2 != NULL){
-    assert(triangleInTile(t2,tt));
-    PQ_insert(tt->pq,t2);
+  split = n;
+  while(sp != NULL && (cur = Q_remove_first(sp->points)) != NULL){
+    if(n == size){
+      size *= 2;
+      nodes = (QNODE**)realloc(nodes, size * sizeof(QNODE*));
+      assert(nodes);
+    }
+    nodes[n++] = cur;
   }
 
-  if(t3 != NULL && t3->maxE == DONE){ 
-    // If all the points in t1 are nodata and there are points in t1
-    // then this triangle should be marked to not be drawn
-    if(hasNoData3){
-      Q_free_queue(t3->points);
-      t3->points = NULL;
-      t3->maxErrorValue = 0;
+  DISTR_CHUNK *chunks = (DISTR_CHUNK*)malloc(nthreads * sizeof(DISTR_CHUNK));
+  pthread_t *threads = (pthread_t*)malloc(nthreads * sizeof(pthread_t));
+  assert(chunks && threads);
+
+  for(i = 0; i < nthreads; i++){
+    chunks[i].nodes = nodes;
+    chunks[i].start = (unsigned long)n * i / nthreads;
+    chunks[i].end = (unsigned long)n * (i+1) / nthreads;
+    chunks[i].split = split;
+    chunks[i].s = s;
+    chunks[i].sp = sp;
+    for(k = 0; k < 3; k++)
+      chunks[i].t[k] = t[k];
+    chunks[i].e = e;
+    chunks[i].nodata = tt->nodata;
+    chunks[i].worker = i;
+    if(pthread_create(&threads[i], NULL, distrPointsChunk, &chunks[i])){
+      printf("distrPointsParallel: cannot create thread\n");
+      exit(1);
     }
-    else{
-      Q_free_queue(t3->points);
-      t3->points = NULL;
-      t3->maxErrorValue = 0;
+  }
+  for(i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  // The serial distribution inserts at the head, so the list of a new
+  // triangle is its chunks in reverse order. The max error point is
+  // chosen as in distrPoints, whatever the order of the chunks
+  for(i = 0; i < nthreads; i++){
+    for(k = 0; k < 3; k++){
+      if(t[k] == NULL)
+	continue;
+      if(chunks[i].head[k] != NULL){
+	chunks[i].tail[k]->next = t[k]->points->next;
+	t[k]->points->next = chunks[i].head[k];
+      }
+      if(chunks[i].maxE[k] != NULL && 
+	 (t[k]->maxE == DONE || 
+	  isNewMaxE(chunks[i].max[k],chunks[i].maxE[k],t[k]->maxErrorValue,
+		    t[k]->maxE))){
+	t[k]->maxE = chunks[i].maxE[k];
+	t[k]->maxErrorValue = chunks[i].max[k];
+      }
     }
+    for(cur = chunks[i].skip; cur != NULL; cur = next){
+      next = cur->next;
+      memFree(MEM_QUEUE, cur, sizeof(QNODE));
+    }
+    refineStats.pointMoves += chunks[i].moves;
+  }
+
+  Q_free_queue(s->points);
+  s->points = NULL;
+  if(sp != NULL){
+    Q_free_queue(sp->points);
+    sp->points = NULL;
   }
-  else if(t3 != NULL){ 
-    assert(triangleInTile(t2,tt));
-    PQ_insert(tt->pq,t3);
+
+  free(threads);
+  free(chunks);
+  free(nodes);
+}
+
+
+//
+// Thread function of distrPointsParallel, arg is a DISTR_CHUNK
+//
+void *distrPointsChunk(void *arg){
+  DISTR_CHUNK *c = (DISTR_CHUNK*)arg;
+  unsigned int i;
+  int k;
+  TRIANGLE *s;
+  QNODE *cur;
+  ELEV_TYPE tempE;
+
+  traceThread(c->worker);
+  TRACE_BEGIN("distrPointsChunk");
+  for(k = 0; k < 3; k++){
+    c->head[k] = c->tail[k] = NULL;
+    c->max[k] = c->e;
+    c->maxE[k] = NULL;
+  }
+  c->skip = NULL;
+  c->moves = 0;
+
+  for(i = c->start; i < c->end; i++){
+    cur = c->nodes[i];
+    s = (i < c->split) ? c->s : c->sp;
+    assert(inTri2D(s->p1, s->p2, s->p3, &cur->e));
+
+    // skip the point with the maxE unless s is marked for deletion,
+    // as in distrPoints
+    if(cur->e.x == s->maxE->x && cur->e.y == s->maxE->y && 
+       !(s->p1p2 == NULL && s->p1p3 == NULL && s->p2p3 == NULL)){
+      cur->next = c->skip;
+      c->skip = cur;
+      continue;
+    }
+
+    k = pickTri(c->t,3,&cur->e);
+
+    //should never get here if point is not nodata
+    if(k < 0){
+      if(cur->e.z != c->nodata){
+	assert(0);
+	exit(1);
+      }
+      cur->next = c->skip;
+      c->skip = cur;
+      continue;
+    }
+
+    cur->next = c->head[k];
+    if(c->head[k] == NULL)
+      c->tail[k] = cur;
+    c->head[k] = cur;
+    c->moves++;
+
+    tempE = findError(cur->e.x, cur->e.y, cur->e.z, c->t[k]);
+    if(isNewMaxE(tempE,&cur->e,c->max[k],c->maxE[k])){
+      c->max[k] = tempE;
+      c->maxE[k] = &cur->e;
+    }
   }
+  TRACE_END("distrPointsChunk");
+  statsFlushThread();
+  return NULL;
 }
 
 
@@ -40,6 +40,136 @@
 #include "qsort.h"
 
 
+//
+// Options which tune the refinement without changing the interface
+// of refineTin. They are set once in main from the user arguments.
+//
+typedef struct Refine_Opts {
+  short lazySwap;     // defer point redistribution of edge swaps
+  int seedSpacing;    // spacing of the seed lattice, 0 for no seeding
+  int distrThreads;   // threads distributing large point lists
+  int batchSize;      // max triangles refined per round, 1 for greedy
+  double progressInterval; // seconds between progress reports, 0 for none
+} REFINE_OPTS;
+
+// Point lists of about this many points or more are distributed by
+// refineOpts.distrThreads threads
+#define DISTR_PARALLEL_MIN 65536
+
+// Batched refinement: a round takes the triangles with error at least
+// this factor of the max error
+#define BATCH_ERROR_FACTOR 0.9
+
+// The triangles of a round are split between refineOpts.distrThreads
+// threads if they hold about this many points or more
+#define BATCH_PARALLEL_MIN 4096
+
+//
+// A triangle s refined in a batched round and the three triangles t
+// its points go to
+//
+typedef struct Batch_Tri {
+  TRIANGLE *s;
+  TRIANGLE *t[3];
+  R_POINT *p;             // the max error point of s, corner of t
+  QNODE *skip;            // points of s to free
+  unsigned long moves;
+} BATCH_TRI;
+
+//
+// The triangles of a batched round whose points are distributed by
+// one thread. The threads take the next triangle in turn
+//
+typedef struct Batch_Chunk {
+  BATCH_TRI *tris;
+  unsigned int n;
+  unsigned int *next;     // next triangle to distribute, shared
+  ELEV_TYPE e;
+  ELEV_TYPE nodata;
+  int worker;             // thread number in the trace, -1 if the
+                          // chunk runs on the calling thread
+} BATCH_CHUNK;
+
+//
+// The part of a point distribution done by one thread: the points
+// nodes[start..end) are sorted into lists for the new triangles t
+//
+typedef struct Distr_Chunk {
+  QNODE **nodes;          // points of s followed by the points of sp
+  unsigned int start;
+  unsigned int end;
+  unsigned int split;     // nodes before split come from s
+  TRIANGLE *s, *sp;
+  TRIANGLE *t[3];
+  ELEV_TYPE e;
+  ELEV_TYPE nodata;
+  QNODE *head[3];         // point list of t[k] for this chunk
+  QNODE *tail[3];
+  QNODE *skip;            // points to free
+  ELEV_TYPE max[3];       // max error in t[k] for this chunk
+  R_POINT *maxE[3];
+  unsigned long moves;
+  int worker;             // thread number in the trace
+} DISTR_CHUNK;
+
+//
+// The rows [startRow,endRow) of a tile split between the two initial
+// triangles by one thread
+//
+typedef struct Init_Chunk {
+  TIN_TILE *tt;
+  ELEV_TYPE *buf;         // the tile, in row major order
+  int startRow;
+  int endRow;
+  short useNodata;
+  TRIANGLE (*phase)[2];   // the two triangles with the corner heights
+                          // of the first, middle and last rows
+  QNODE *head[2];         // point list of each triangle for this chunk
+  QNODE *tail[2];
+  ELEV_TYPE max[2];       // max error in each triangle for this chunk
+  R_POINT *maxE[2];
+  int worker;             // thread number in the trace, -1 if the
+                          // chunk runs on the calling thread
+} INIT_CHUNK;
+
+//
+// Counters of point movement between triangle point lists, reported
+// at the end of a run
+//
+typedef struct Refine_Stats {
+  unsigned long pointMoves;      // points moved into a new point list
+  unsigned long swapPointMoves;  // part of pointMoves due to edge swaps
+  unsigned long edgeSwaps;       // number of edge swaps
+} REFINE_STATS;
+
+//
+// Progress of refineTin, for the progress reports
+//
+typedef struct Refine_Progress {
+  TIN *tin;
+  double start;            // wall clock at the start of refineTin
+  double last;             // wall clock of the last report
+  long cells;              // cells of all the tiles
+  long cellsDone;          // cells of the tiles refined
+  unsigned int tiles;
+  unsigned int tilesDone;
+} REFINE_PROGRESS;
+
+// The clock is read every PROGRESS_CHECK insertions or batched rounds
+// to see if a progress report is due
+#define PROGRESS_CHECK 1024
+
+extern REFINE_OPTS refineOpts;
+extern REFINE_STATS refineStats;
+
+//
+// Convergence curve: curvePoints[E] is the number of points the
+// refinement would insert with error E, found from the order the
+// points are inserted at a smaller error. NULL when not recorded
+//
+extern unsigned long *curvePoints;
+
+
 //
 // Initialize TIN structure, returns a pointer to lower left tri. This
 // will not initialize the points in the triangles, just the two
@@ -63,6 +193,61 @@ void pointNeighborTileTo(TIN_TILE *tt, short dir, TIN_TILE *ttn);
 TIN *initTin(TILED_GRID *fullGrid, double e, double mem, short useNodata,
 	     char *name);
 
+//
+// A tile is flat if the height range of its grid is below e. Every
+// point is then within e of the two initial triangles since their
+// corners are grid points of the tile too
+//
+short isFlatTile(TIN_TILE *tt, double e);
+
+//
+// A tile is empty if all its grid points are nodata and nodata
+// points are skipped. Then there is nothing to refine
+//
+short isEmptyTile(TIN_TILE *tt, short useNodata);
+
+//
+// Initialize a flat or empty tile. Only the heights of the corners
+// are read from the tile file and the two initial triangles are
+// marked done without building point lists
+//
+void initFlatTile(TIN_TILE *tt);
+
+//
+// Add a grid point of a tile read from file at (row,col) of the tile
+// to the point list of one of the two initial triangles
+//
+void addInitialPoint(TIN_TILE *tt, int row, int col, ELEV_TYPE z,
+		     short useNodata);
+
+//
+// Set the corners of a tile which are in the cells [from,to) of the
+// tile file (in row major order) to nodata. This is used when reading
+// only the runs of valid cells of a tile, for the cells in between.
+//
+void setSkippedCorners(TIN_TILE *tt, long from, long to);
+
+//
+// Split the dense tile buf into the two initial triangles using
+// refineOpts.distrThreads threads. The point lists, max errors and
+// seeds are the same as the ones of addInitialPoint called on every
+// cell in row major order
+//
+void splitTileCells(TIN_TILE *tt, ELEV_TYPE *buf, short useNodata);
+
+//
+// Thread function of splitTileCells, arg is an INIT_CHUNK
+//
+void *splitTileChunk(void *arg);
+
+//
+// Read all the points of a tile from file and distribute them to the
+// point lists of the two initial triangles. If the tile is mostly
+// nodata and we skip nodata then only the runs of valid cells
+// recorded while tiling are read
+//
+void initTilePointLists(TIN_TILE *tt, short useNodata);
+
 //
 // Add the points two the two initial triangles of a Tin tile from
 // file. Also add points from neighbor boundary arrays to the
@@ -87,6 +272,39 @@ int CircumCircle(double xp,double yp,double x1,double y1,
 void edgeSwap(TRIANGLE *t1, TRIANGLE *t2, 
 	      R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *d,
 	      double e, TIN_TILE *tt);
+//
+// Lazy edge swaps: move the point list of a triangle consumed by an
+// edge swap into the swap pool of the tile. Returns 1 if the area of
+// t may contain points (t had a point list or was dirty) else 0
+//
+short deferSwapPoints(TRIANGLE *t, TIN_TILE *tt);
+
+//
+// Edge swaps: add a triangle created by an edge swap to the dirty set
+// of the tile. The index in the set is kept in pqIndex while the
+// triangle is not in the PQ
+//
+void addDirty(TRIANGLE *t, TIN_TILE *tt);
+
+//
+// Edge swaps: take a triangle consumed by an edge swap out of the
+// dirty set of the tile
+//
+void removeDirty(TRIANGLE *t, TIN_TILE *tt);
+
+//
+// Lazy edge swaps: mark a triangle created by an edge swap as dirty,
+// its point list is built by flushSwapPoints
+//
+void markDirty(TRIANGLE *t, TIN_TILE *tt);
+
+//
+// Edge swaps: once the Delaunay cascade is done distribute the points
+// pooled by lazy swaps among the dirty triangles, then insert the
+// dirty triangles in the PQ or free the points of the done ones
+//
+void flushSwapPoints(TIN_TILE *tt, double e);
+
 //
 // Enforce delaunay on triangle t. Assume that p1 & p2 are the
 // endpoints to the edge that is being checked for delaunay
@@ -107,6 +325,117 @@ void refineTin(double e, short delaunay, TIN *tin,char *path,
 //
 void refineTile(TIN_TILE *tt, double e, short delaunay, short useNodata);
 
+//
+// Print a progress report to stderr if refineOpts.progressInterval
+// seconds have passed since the last one, or if force is set. tt is
+// the tile being refined with max error maxErr, or NULL between tiles
+//
+void reportProgress(TIN_TILE *tt, ELEV_TYPE maxErr, short force);
+
+//
+// Start recording the convergence curve
+//
+void initCurve();
+
+//
+// Convergence curve: record the insertion of a point of error err in
+// tile tt
+//
+void recordCurvePoint(TIN_TILE *tt, ELEV_TYPE err);
+
+//
+// Convergence curve: record the insertion of a seed of error err
+//
+void recordCurveSeed(ELEV_TYPE err);
+
+//
+// Convergence curve: add the points inserted in tile tt to the
+// errors not reached in the tile
+//
+void endCurveTile(TIN_TILE *tt);
+
+//
+// Write the convergence curve of tin refined with error e to a CSV
+// file, from the largest error down to e
+//
+void writeCurve(char *path, TIN *tin, double e);
+
+//
+// Seeding: keep p as the seed of its block if its error is the
+// largest so far. Only points inside the tile are seeded
+//
+void updateSeed(TIN_TILE *tt, int row, int col, R_POINT *p, 
+		ELEV_TYPE err);
+
+//
+// Find the triangle containing point p by walking from triangle t
+// towards p. Returns NULL if not found in maxSteps steps
+//
+TRIANGLE *locateTriangle(TRIANGLE *t, R_POINT *p, unsigned int maxSteps);
+
+//
+// Seeding: insert the seed of every block whose error is at least e
+// before the greedy refinement starts, so that the first point lists
+// to distribute are small. Returns the number of points inserted
+//
+unsigned int seedTile(TIN_TILE *tt, double e, short delaunay);
+
+//
+// Batched refinement: take up to refineOpts.batchSize triangles with
+// error close to the max error and whose neighbourhoods don't overlap
+// from the PQ, split them at their max error points and distribute
+// their points in parallel, then enforce Delaunay around the new
+// points. round is scratch space for batchSize triangles and deferred
+// for 2*batchSize. Returns the number of points inserted
+//
+unsigned int refineBatch(TIN_TILE *tt, double e, short delaunay, 
+			 BATCH_TRI *round, TRIANGLE **deferred);
+
+//
+// Returns 1 if t and the first n triangles of round share no
+// triangle or neighbor else 0
+//
+short batchIndependent(BATCH_TRI *round, unsigned int n, TRIANGLE *t);
+
+//
+// Distribute the points of the triangles of a batched round to their
+// new triangles, using refineOpts.distrThreads threads if there are
+// enough points
+//
+void distrBatch(TIN_TILE *tt, BATCH_TRI *round, unsigned int n, double e);
+
+//
+// Thread function of distrBatch, arg is a BATCH_CHUNK
+//
+void *distrBatchChunk(void *arg);
+
+//
+// Batched refinement: the edge opposite p in t is still to be checked
+// for Delaunay
+//
+void addBatchEdge(TIN_TILE *tt, TRIANGLE *t, R_POINT *p);
+
+//
+// Batched refinement: called by edgeSwap before t1 and t2 are replaced
+// by tn1 and tn2. The edges still to be checked in t1 and t2 move to
+// the new triangles with the same point
+//
+void swapBatchEdges(TIN_TILE *tt, TRIANGLE *t1, TRIANGLE *t2,
+		    TRIANGLE *tn1, TRIANGLE *tn2);
+
+//
+// Copy the max error point of s, which becomes a corner, into the
+// point arrays of tile tt and return the copy
+//
+R_POINT *addMaxErrorPoint(TIN_TILE *tt, TRIANGLE *s);
+
+//
+// Insert the max error point of s (s->maxE) into the triangulation of
+// tile tt. s must already be out of the PQ, it is split and removed
+//
+void insertMaxErrorPoint(TIN_TILE *tt, TRIANGLE *s, double e, 
+			 short delaunay);
+
 //
 // Add triangles and distribute points when there are two collinear
 // triangles. Assumes that maxE is on line pa pb
@@ -124,6 +453,26 @@ void fixCollinear(R_POINT *pa, R_POINT *pb, R_POINT *pc, TRIANGLE* s,
  void distrPoints(TRIANGLE* t1, TRIANGLE* t2, TRIANGLE* t3, TRIANGLE* s, 
 		  TRIANGLE* sp, double e, TIN_TILE *tt);
 
+//
+// Last step of a point distribution: insert new triangle t in the PQ,
+// or free its point list if it is done
+//
+void finishDistrTri(TRIANGLE *t, TIN_TILE *tt);
+
+//
+// Distribute the points of s and sp into the new triangles t using
+// refineOpts.distrThreads threads. The point lists and max errors are
+// the same as the ones of the serial distribution
+//
+void distrPointsParallel(TRIANGLE* t[3], TRIANGLE* s, TRIANGLE* sp, 
+			 double e, TIN_TILE *tt);
+
+//
+// Thread function of distrPointsParallel, arg is a DISTR_CHUNK
+//
+void *distrPointsChunk(void *arg);
+
+
 //
 // This function is called when we are refining the lower left most
 // triangle since we need to choose the new lower left triangle
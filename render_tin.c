@@ -137,7 +137,7 @@ float z_map(int h){
 
 
 //
-// Traverse a tin_tile rendering each triangle
+// Render each triangle of a tin_tile
 //
 void drawTinTile(TIN_TILE *tt){
   double interval,x0,y0;
@@ -178,61 +178,40 @@ void drawTinTile(TIN_TILE *tt){
   // if the tin only has two init tris don't print it
   if(1){
     
-    TRIANGLE *curT = tt->t;
-    TRIANGLE *prevT = curT;
+    TRIANGLE *t;
+    unsigned int pos = 0;
     
-    // Create an edge which 
-    EDGE curE;
-    curE.type = IN;
-    curE.t1 = NULL;
-    curE.t2 = tt->t;
-    curE.p1 = tt->e.p1;
-    curE.p2 = tt->e.p2;
-    
-    // Traverse the tin and draw triangles till we get back to the start edge
-    do {
-      // Print triangle if it we are on an IN edge
-      if(curE.type == IN && prevT != NULL){
-	// Don't print tri if it has a nodata corner point
-	if(prevT->p1->z != tt->nodata &&
-	   prevT->p2->z != tt->nodata &&
-	   prevT->p3->z != tt->nodata &&
-	   prevT->p1->z != tt->min-1 &&
-	   prevT->p2->z != tt->min-1 &&
-	   prevT->p3->z != tt->min-1){
-	//if(1){
-	  
-       	  // Draw the triangle
-	  glBegin(GL_POLYGON);
-	  
-	  
-
-	    colorMap(prevT->p1->z);
-	  glVertex3f(((double) prevT->p1->y)*interval+x0,
-		     y0 - ((double)prevT->p1->x)*interval,
-		     z_map(prevT->p1->z));
-	  
-	  colorMap(prevT->p2->z);
-	  glVertex3f(((double) prevT->p2->y)*interval+x0,
-		     y0 - ((double) prevT->p2->x)*interval,
-		     z_map(prevT->p2->z));
-
-	  colorMap(prevT->p3->z);
-	  glVertex3f(((double) prevT->p3->y)*interval+x0,
-		     y0 - ((double) prevT->p3->x)*interval,
-		     z_map(prevT->p3->z));
-	  
-	  glEnd();
+    // Draw every triangle of the tile once
+    while((t = nextTri(&tt->tris,&pos)) != NULL){
+      // Don't print tri if it has a nodata corner point
+      if(t->p1->z != tt->nodata &&
+	 t->p2->z != tt->nodata &&
+	 t->p3->z != tt->nodata &&
+	 t->p1->z != tt->nodataZ &&
+	 t->p2->z != tt->nodataZ &&
+	 t->p3->z != tt->nodataZ){
+	
+	// Draw the triangle
+	glBegin(GL_POLYGON);
+	
+	colorMap(t->p1->z);
+	glVertex3f(((double) t->p1->y)*interval+x0,
+		   y0 - ((double)t->p1->x)*interval,
+		   z_map(t->p1->z));
+	
+	colorMap(t->p2->z);
+	glVertex3f(((double) t->p2->y)*interval+x0,
+		   y0 - ((double) t->p2->x)*interval,
+		   z_map(t->p2->z));
+	
+	colorMap(t->p3->z);
+	glVertex3f(((double) t->p3->y)*interval+x0,
+		   y0 - ((double) t->p3->x)*interval,
+		   z_map(t->p3->z));
 	
-	}
+	glEnd();
       }
-      // Go to next edge
-      prevT = curT;
-      curT = nextEdge(curT,tt->v,&curE,tt);
-      assert(curT);
-      
-    } while((curE.p1 != tt->e.p1 || curE.p2 != tt->e.p2) && 
-	    (curE.p1 != tt->e.p2 || curE.p2 != tt->e.p1));
+    }
   }
 }
 
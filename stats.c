@@ -0,0 +1,255 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * stats.c counts and times the hot operations of the refinement, per
+ * tile and per run, and writes them to a JSON file
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "stats.h"
+#include "refine_tin.h"
+#include "mem_manager.h"
+
+// Counters of the calling thread
+__thread STATS_COUNTERS statsLocal;
+
+// Time the timed operations, only worth two gettimeofday calls per
+// operation if the counters are written
+short statsTiming = 0;
+
+// Timers of the calling thread
+static __thread int statsDepth[STAT_LAST_TIMED+1];
+static __thread double statsStartTime[STAT_LAST_TIMED+1];
+
+// Counters flushed by worker threads since the last tile
+static STATS_COUNTERS statsWorkers;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Counters of the tiles, and of the run before the current tile
+static STATS_TILE *statsTiles = NULL;
+static unsigned int statsTileCount = 0;
+static unsigned int statsTileSize = 0;
+static STATS_COUNTERS statsTileStart;
+static double statsTileStartTime;
+
+// Names of the operations in the JSON file
+static char *statsNames[STAT_NUM] = {
+  "distrPoints", "edgeSwap", "fixCollinear", "tileRead", "tileWrite",
+  "inTri2D", "findError", "PQ_insert", "PQ_extractMin", "PQ_delete"
+};
+
+
+//
+// Wall clock in seconds
+//
+static double statsNow(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//
+// Add the counters b to a
+//
+static void statsAdd(STATS_COUNTERS *a, STATS_COUNTERS *b){
+  int i;
+  for(i = 0; i < STAT_NUM; i++){
+    a->count[i] += b->count[i];
+    a->seconds[i] += b->seconds[i];
+  }
+}
+
+
+//
+// Count a call of a timed operation and start its timer. Recursive
+// calls are counted but only the outermost one is timed
+//
+void statsStart(int op){
+  assert(op <= STAT_LAST_TIMED);
+  statsLocal.count[op]++;
+  if(statsDepth[op]++ == 0)
+    statsStartTime[op] = statsNow();
+}
+
+
+//
+// Stop the timer of a timed operation
+//
+void statsStop(int op){
+  assert(op <= STAT_LAST_TIMED && statsDepth[op] > 0);
+  if(--statsDepth[op] == 0)
+    statsLocal.seconds[op] += statsNow() - statsStartTime[op];
+}
+
+
+//
+// Add the counters of a worker thread to the run, called by the
+// thread before it exits
+//
+void statsFlushThread(){
+  pthread_mutex_lock(&statsMutex);
+  statsAdd(&statsWorkers, &statsLocal);
+  pthread_mutex_unlock(&statsMutex);
+  memset(&statsLocal, 0, sizeof(STATS_COUNTERS));
+}
+
+
+//
+// Start the counters and the memory high-water mark of a tile
+//
+void statsBeginTile(){
+  memBeginTile();
+  statsTileStart = statsLocal;
+  statsTileStartTime = statsNow();
+}
+
+
+//
+// Record the counters of the tile started by statsBeginTile
+//
+void statsEndTile(COORD_TYPE iOffset, COORD_TYPE jOffset,
+		  unsigned int numTris, unsigned int numPoints){
+  STATS_TILE *st;
+  int i;
+
+  // The workers have joined, their counters belong to this tile
+  pthread_mutex_lock(&statsMutex);
+  statsAdd(&statsLocal, &statsWorkers);
+  memset(&statsWorkers, 0, sizeof(STATS_COUNTERS));
+  pthread_mutex_unlock(&statsMutex);
+
+  if(statsTileCount == statsTileSize){
+    statsTileSize = statsTileSize ? 2 * statsTileSize : 64;
+    statsTiles = (STATS_TILE*)realloc(statsTiles,
+				      statsTileSize * sizeof(STATS_TILE));
+    assert(statsTiles);
+  }
+  st = &statsTiles[statsTileCount++];
+  st->iOffset = iOffset;
+  st->jOffset = jOffset;
+  st->numTris = numTris;
+  st->numPoints = numPoints;
+  st->seconds = statsNow() - statsTileStartTime;
+  st->memPeak = memTilePeak();
+  for(i = 0; i < STAT_NUM; i++){
+    st->c.count[i] = statsLocal.count[i] - statsTileStart.count[i];
+    st->c.seconds[i] = statsLocal.seconds[i] - statsTileStart.seconds[i];
+  }
+}
+
+
+//
+// Write the operations of counters c as a JSON object
+//
+static void statsWriteOps(FILE *fp, STATS_COUNTERS *c, char *indent){
+  int i;
+
+  fprintf(fp, "{");
+  for(i = 0; i < STAT_NUM; i++){
+    fprintf(fp, "%s\n%s  \"%s\": {\"calls\": %lu", i ? "," : "", indent,
+	    statsNames[i], c->count[i]);
+    if(i <= STAT_LAST_TIMED)
+      fprintf(fp, ", \"seconds\": %.6f", c->seconds[i]);
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "\n%s}", indent);
+}
+
+
+//
+// Write the run and tile counters of the refinement of tin with error
+// err to a JSON file, with the timings of the phases named in
+// phaseNames
+//
+void statsWrite(char *path, struct Tin *tin, double err,
+		char *phaseNames[], Rtimer phases[], int numPhases){
+  FILE *fp;
+  STATS_COUNTERS run;
+  unsigned int i;
+
+  if((fp = fopen(path, "w")) == NULL){
+    fprintf(stderr, "statsWrite: can't write to %s ",path);
+    perror("statsWrite:");
+    exit(1);
+  }
+
+  memset(&run, 0, sizeof(STATS_COUNTERS));
+  for(i = 0; i < statsTileCount; i++)
+    statsAdd(&run, &statsTiles[i].c);
+
+  fprintf(fp, "{\n");
+#ifdef NO_STATS
+  fprintf(fp, "  \"instrumented\": false,\n");
+#else
+  fprintf(fp, "  \"instrumented\": true,\n");
+#endif
+  fprintf(fp, "  \"run\": {\"error\": %.4f, \"rows\": %d, \"cols\": %d, "
+	  "\"tiles\": %u, \"triangles\": %u, \"points\": %u,\n"
+	  "          \"pointMoves\": %lu, \"edgeSwaps\": %lu, "
+	  "\"swapPointMoves\": %lu,\n"
+	  "          \"lazy\": %d, \"seed\": %d, \"threads\": %d, "
+	  "\"batch\": %d},\n",
+	  err, tin->nrows, tin->ncols, tin->numTiles, tin->numTris,
+	  tin->numPoints, refineStats.pointMoves, refineStats.edgeSwaps,
+	  refineStats.swapPointMoves, refineOpts.lazySwap,
+	  refineOpts.seedSpacing, refineOpts.distrThreads,
+	  refineOpts.batchSize);
+
+  fprintf(fp, "  \"memory\": {\"peak\": %ld, \"current\": %ld",
+	  memUsage.totalPeak, memUsage.total);
+  for(i = 0; i < MEM_NUM; i++)
+    fprintf(fp, ",\n    \"%s\": {\"peak\": %ld, \"current\": %ld}",
+	    memNames[i], memUsage.peak[i], memUsage.current[i]);
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"phases\": {");
+  for(i = 0; i < numPhases; i++)
+    fprintf(fp, "%s\n    \"%s\": {\"wall\": %.6f, \"user\": %.6f, "
+	    "\"sys\": %.6f}", i ? "," : "", phaseNames[i],
+	    rt_w_useconds(phases[i]) / 1000000,
+	    rt_u_useconds(phases[i]) / 1000000,
+	    rt_s_useconds(phases[i]) / 1000000);
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"ops\": ");
+  statsWriteOps(fp, &run, "  ");
+  fprintf(fp, ",\n");
+
+  fprintf(fp, "  \"tiles\": [");
+  for(i = 0; i < statsTileCount; i++){
+    fprintf(fp, "%s\n    {\"iOffset\": %d, \"jOffset\": %d, "
+	    "\"triangles\": %u, \"points\": %u, \"seconds\": %.6f,\n"
+	    "     \"memPeak\": %ld, \"ops\": ", i ? "," : "",
+	    statsTiles[i].iOffset, statsTiles[i].jOffset, statsTiles[i].numTris,
+	    statsTiles[i].numPoints, statsTiles[i].seconds,
+	    statsTiles[i].memPeak);
+    statsWriteOps(fp, &statsTiles[i].c, "     ");
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+}
@@ -0,0 +1,132 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * stats.h counts and times the hot operations of the refinement, per
+ * tile and per run, and writes them to a JSON file
+ *
+ * COMMENTS:
+ *
+ * Counters are kept per thread and folded into the totals of the
+ * main thread at the end of each tile. The timed operations are only
+ * timed if statsTiming is set, otherwise they are only counted.
+ * Compiling with -DNO_STATS removes all the instrumentation, the JSON
+ * file then only has the phase timings.
+ *
+ *****************************************************************************/
+
+#ifndef __stats_h
+#define __stats_h
+
+#include "point.h"
+#include "rtimer.h"
+
+struct Tin;
+
+//
+// Instrumented operations. Those up to STAT_LAST_TIMED are also
+// timed, the others are only counted as they are too cheap to time
+//
+enum {
+  STAT_DISTR_POINTS,    // distrPoints
+  STAT_EDGE_SWAP,       // edgeSwap
+  STAT_FIX_COLLINEAR,   // fixCollinear
+  STAT_TILE_READ,       // initTilePointLists
+  STAT_TILE_WRITE,      // writeTinTile
+  STAT_IN_TRI,          // inTri2D
+  STAT_FIND_ERROR,      // findError
+  STAT_PQ_INSERT,       // PQ_insert
+  STAT_PQ_EXTRACT,      // PQ_extractMin
+  STAT_PQ_DELETE,       // PQ_delete
+  STAT_NUM
+};
+#define STAT_LAST_TIMED STAT_TILE_WRITE
+
+typedef struct Stats_Counters {
+  unsigned long count[STAT_NUM];  // number of calls
+  double seconds[STAT_NUM];       // wall time of the timed operations
+} STATS_COUNTERS;
+
+//
+// Counters of one tile
+//
+typedef struct Stats_Tile {
+  COORD_TYPE iOffset;
+  COORD_TYPE jOffset;
+  unsigned int numTris;
+  unsigned int numPoints;
+  double seconds;           // wall time to refine and write the tile
+  long memPeak;             // high-water mark of tracked memory in bytes
+  STATS_COUNTERS c;
+} STATS_TILE;
+
+// Counters of the calling thread
+extern __thread STATS_COUNTERS statsLocal;
+
+// Time the timed operations, set before the refinement starts
+extern short statsTiming;
+
+#ifdef NO_STATS
+#define STATS_COUNT(op)
+#define STATS_START(op)
+#define STATS_STOP(op)
+#else
+#define STATS_COUNT(op) (statsLocal.count[op]++)
+#define STATS_START(op) \
+  do { if(statsTiming) statsStart(op); else STATS_COUNT(op); } while(0)
+#define STATS_STOP(op) \
+  do { if(statsTiming) statsStop(op); } while(0)
+#endif
+
+//
+// Count a call of a timed operation and start its timer. Recursive
+// calls are counted but only the outermost one is timed
+//
+void statsStart(int op);
+
+//
+// Stop the timer of a timed operation
+//
+void statsStop(int op);
+
+//
+// Add the counters of a worker thread to the run, called by the
+// thread before it exits
+//
+void statsFlushThread();
+
+//
+// Start the counters and the memory high-water mark of a tile
+//
+void statsBeginTile();
+
+//
+// Record the counters of the tile started by statsBeginTile
+//
+void statsEndTile(COORD_TYPE iOffset, COORD_TYPE jOffset,
+		  unsigned int numTris, unsigned int numPoints);
+
+//
+// Write the run and tile counters of the refinement of tin with error
+// err to a JSON file, with the timings of the phases named in
+// phaseNames
+//
+void statsWrite(char *path, struct Tin *tin, double err,
+		char *phaseNames[], Rtimer phases[], int numPhases);
+
+#endif
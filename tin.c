@@ -29,6 +29,8 @@
  *****************************************************************************/
 
 #include "tin.h"
+#include "stats.h"
+#include "mem_manager.h"
 
 // Debug mode
 #define DEBUG if(0)
@@ -43,7 +45,7 @@ R_POINT *DONE = &DONEVar;
 //
 TRIANGLE* addTri(TIN_TILE *tt, R_POINT *p1, R_POINT *p2, R_POINT *p3, 
 		 TRIANGLE *t12, TRIANGLE *t13, TRIANGLE *t23) {
-  assert(p1 && p2 && p3 && tt && tt->pq);
+  assert(p1 && p2 && p3 && tt);
   
   // Validate that the triangle is not collinear
   assert(areaSign(p1,p2,p3));
@@ -53,11 +55,12 @@ TRIANGLE* addTri(TIN_TILE *tt, R_POINT *p1, R_POINT *p2, R_POINT *p3,
 
   // Allocate space for this triangle and give it values
   TRIANGLE *tn;
-  tn = (TRIANGLE*)malloc(sizeof(TRIANGLE));
+  tn = allocTri(tt);
   assert(tn);
   
   // Assign values to the triangle
   tn->maxE = NULL;
+  tn->maxErrorValue = 0;
   tn->points = NULL;
   tn->pqIndex = UINT_MAX;
   tn->p1=p1;
@@ -151,32 +154,12 @@ void pointNeighborTriTo(TRIANGLE *t,R_POINT *pa,R_POINT *pb,TRIANGLE *tn){
 // Print the triangles in a TIN_TILE for debugging
 //
 void printTinTile(TIN_TILE* tinTile){
-  TRIANGLE *curT = tinTile->t;
-  TRIANGLE *prevT = curT;
-  
-  // Create an edge which 
-  EDGE curE;
-  curE.type = IN;
-  curE.t1 = NULL;
-  curE.t2 = tinTile->t;
-  curE.p1 = tinTile->e.p1;
-  curE.p2 = tinTile->e.p2;
-  printf("\n\n PRINTING TIN_TILE \n\n");
-
-  do{
-    // Print tri if we are on its IN edge
-    if(curE.type == IN && prevT != NULL){
-      printTriangle(prevT);
-    }
+  TRIANGLE *t;
+  unsigned int pos = 0;
 
-    // Go to next edge
-    prevT=curT;
-    curT = nextEdge(curT,tinTile->v,&curE,tinTile);
-    assert(curT);
-    
-  }while((curE.p1 != tinTile->e.p1 || curE.p2 != tinTile->e.p2) && 
-	 (curE.p1 != tinTile->e.p2 || curE.p2 != tinTile->e.p1));
-  
+  printf("\n\n PRINTING TIN_TILE \n\n");
+  while((t = nextTri(&tinTile->tris,&pos)) != NULL)
+    printTriangle(t);
 }
 
 
@@ -790,11 +773,166 @@ TRIANGLE *nextEdge(TRIANGLE *t, R_POINT *v, EDGE *edge, TIN_TILE *tt){
 
 
 //
-// Remove triangle from TIN_TILE and free memory
+// Remove triangle from TIN_TILE, its memory is reused by the tile
+//
+void removeTri(TIN_TILE *tt, TRIANGLE* t) {
+  assert(tt && t);
+  TRI_ARENA *a = &tt->tris;
+
+  if(a->freeCount == a->freeSize){
+    a->freeTris = (TRIANGLE**)memRealloc(MEM_TRI, a->freeTris, 
+					 a->freeSize * sizeof(TRIANGLE*),
+					 (a->freeSize ? 2 * a->freeSize :
+					  TRI_BLOCK_SIZE) * sizeof(TRIANGLE*));
+    a->freeSize = a->freeSize ? 2 * a->freeSize : TRI_BLOCK_SIZE;
+    assert(a->freeTris);
+  }
+  t->p1 = NULL;
+  a->freeTris[a->freeCount++] = t;
+}
+
+
+//
+// Number of triangles in block b of a triangle arena
+//
+static unsigned int triBlockSize(unsigned int b){
+  unsigned int size = TRI_FIRST_BLOCK;
+  while(b-- > 0 && size < TRI_BLOCK_SIZE)
+    size *= 2;
+  return size;
+}
+
+
+//
+// Initialize an empty triangle arena, no block is allocated until the
+// first triangle is
+//
+void initTriArena(TRI_ARENA *a){
+  a->blocks = NULL;
+  a->numBlocks = a->blocksSize = 0;
+  a->used = 0;
+  a->freeTris = NULL;
+  a->freeCount = a->freeSize = 0;
+}
+
+
+//
+// Get memory for a triangle from the arena of tile tt
+//
+TRIANGLE *allocTri(TIN_TILE *tt){
+  TRI_ARENA *a = &tt->tris;
+
+  // Reuse the last removed triangle
+  if(a->freeCount > 0)
+    return a->freeTris[--a->freeCount];
+
+  // Start a new block
+  if(a->numBlocks == 0 || a->used == triBlockSize(a->numBlocks-1)){
+    if(a->numBlocks == a->blocksSize){
+      a->blocks = (TRIANGLE**)memRealloc(MEM_TRI, a->blocks, 
+					 a->blocksSize * sizeof(TRIANGLE*),
+					 (a->blocksSize ? 2 * a->blocksSize :
+					  16) * sizeof(TRIANGLE*));
+      a->blocksSize = a->blocksSize ? 2 * a->blocksSize : 16;
+      assert(a->blocks);
+    }
+    a->blocks[a->numBlocks] = 
+      (TRIANGLE*)memAlloc(MEM_TRI, triBlockSize(a->numBlocks) * 
+			  sizeof(TRIANGLE));
+    assert(a->blocks[a->numBlocks]);
+    a->numBlocks++;
+    a->used = 0;
+  }
+  return &a->blocks[a->numBlocks-1][a->used++];
+}
+
+
+//
+// Free all the triangles of an arena
 //
-void removeTri(TRIANGLE* t) {
-  assert(t);
-  free(t);
+void freeTriArena(TRI_ARENA *a){
+  unsigned int i;
+  for(i = 0; i < a->numBlocks; i++)
+    memFree(MEM_TRI, a->blocks[i], triBlockSize(i) * sizeof(TRIANGLE));
+  memFree(MEM_TRI, a->blocks, a->blocksSize * sizeof(TRIANGLE*));
+  memFree(MEM_TRI, a->freeTris, a->freeSize * sizeof(TRIANGLE*));
+  initTriArena(a);
+}
+
+
+//
+// Get the next live triangle of arena a after position *pos and
+// advance *pos, NULL when all triangles were visited. Block b starts
+// at position b*TRI_BLOCK_SIZE whatever its size
+//
+TRIANGLE *nextTri(TRI_ARENA *a, unsigned int *pos){
+  TRIANGLE *t;
+  unsigned int b, i;
+
+  while(1){
+    b = *pos / TRI_BLOCK_SIZE;
+    i = *pos % TRI_BLOCK_SIZE;
+    if(b >= a->numBlocks)
+      return NULL;
+    // Past the end of the block, go to the next one
+    if(i >= (b == a->numBlocks-1 ? a->used : triBlockSize(b))){
+      *pos = (b+1) * TRI_BLOCK_SIZE;
+      continue;
+    }
+    t = &a->blocks[b][i];
+    (*pos)++;
+    // Skip removed triangles
+    if(t->p1 != NULL)
+      return t;
+  }
+}
+
+
+//
+// Initialize an empty vertex pool
+//
+void initVertexPool(VERTEX_POOL *vp){
+  vp->blocks = NULL;
+  vp->numBlocks = vp->blocksSize = 0;
+  vp->used = VERTEX_BLOCK_SIZE;
+}
+
+
+//
+// Get memory for an interior vertex from the pool of tile tt
+//
+R_POINT *allocVertex(TIN_TILE *tt){
+  VERTEX_POOL *vp = &tt->verts;
+
+  // Start a new block
+  if(vp->used == VERTEX_BLOCK_SIZE){
+    if(vp->numBlocks == vp->blocksSize){
+      vp->blocks = (R_POINT**)memRealloc(MEM_POINTS, vp->blocks, 
+					 vp->blocksSize * sizeof(R_POINT*),
+					 (vp->blocksSize ? 2 * vp->blocksSize :
+					  16) * sizeof(R_POINT*));
+      vp->blocksSize = vp->blocksSize ? 2 * vp->blocksSize : 16;
+      assert(vp->blocks);
+    }
+    vp->blocks[vp->numBlocks] = 
+      (R_POINT*)memAlloc(MEM_POINTS, VERTEX_BLOCK_SIZE * sizeof(R_POINT));
+    assert(vp->blocks[vp->numBlocks]);
+    vp->numBlocks++;
+    vp->used = 0;
+  }
+  return &vp->blocks[vp->numBlocks-1][vp->used++];
+}
+
+
+//
+// Free all the vertices of a pool
+//
+void freeVertexPool(VERTEX_POOL *vp){
+  unsigned int i;
+  for(i = 0; i < vp->numBlocks; i++)
+    memFree(MEM_POINTS, vp->blocks[i], VERTEX_BLOCK_SIZE * sizeof(R_POINT));
+  memFree(MEM_POINTS, vp->blocks, vp->blocksSize * sizeof(R_POINT*));
+  initVertexPool(vp);
 }
 
 
@@ -891,6 +1029,7 @@ int areaSign(R_POINT *a, R_POINT *b, R_POINT *c){
 int inTri2D(R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *z){
   
   int area0, area1, area2;
+  STATS_COUNT(STAT_IN_TRI);
   
   // Assume no collinear triangles
   assert(areaSign(a, b, c) != 0);
@@ -935,6 +1074,54 @@ int inTri2D(R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *z){
 }
 
 
+//
+// Does triangle abc own point z? A point inside abc is owned by
+// abc. A point on an edge is owned by only one of the two triangles
+// of the edge, the one on the left of the edge directed from its
+// smaller (x,y) endpoint, so the triangle a point ends up in does not
+// depend on the order the triangles are tried. Returns 1 if abc owns
+// z, -1 if z is on an edge of abc owned by the other triangle and 0
+// if z is not in abc
+//
+int ownsPoint2D(R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *z){
+  
+  int area0, area1, area2;
+  R_POINT *u, *v;
+  int side;
+  STATS_COUNT(STAT_IN_TRI);
+  
+  area0 = areaSign( a, b, z);
+  area1 = areaSign( b, c, z);
+  area2 = areaSign( c, a, z);
+
+  // Inside tri
+  if ( ((area0 < 0) && (area1 < 0) && (area2 < 0)) ||
+       ((area1 > 0) && (area0 > 0) && (area2 > 0)) )
+    return 1;
+
+  // On an edge, side is the side of the tri to the edge uv
+  if ( (area0 == 0) && (area1 == area2) && (area1 != 0) ){
+    u = a; v = b; side = area1;
+  }
+  else if ( (area1 == 0) && (area0 == area2) && (area0 != 0) ){
+    u = b; v = c; side = area0;
+  }
+  else if ( (area2 == 0) && (area0 == area1) && (area0 != 0) ){
+    u = c; v = a; side = area0;
+  }
+  // z is either a, b, or c, see inTri2D
+  else if ( (area0 == 0 && area1 == 0) || (area0 == 0 && area2 == 0) ||
+	    (area1 == 0 && area2 == 0) )
+    return 1;
+  else
+    return 0;
+
+  if ( u->x < v->x || (u->x == v->x && u->y < v->y) )
+    return (side > 0) ? 1 : -1;
+  else
+    return (side < 0) ? 1 : -1;
+}
+
 //
 // Validate that all points in a triangle's point list are actually in
 // that triangle
@@ -1058,7 +1245,7 @@ void triangleCheck(TRIANGLE* t,TRIANGLE* t1,TRIANGLE* t2,TRIANGLE* t3){
   if(t3 != NULL){
     // Find center point
     R_POINT *cp;
-    cp = (R_POINT*) malloc(sizeof(R_POINT));
+    cp = NULL;
     if (!isEndPoint(t,t1->p1))
       cp = t1->p1;
     if (!isEndPoint(t,t1->p2))
@@ -1084,7 +1271,7 @@ void triangleCheck(TRIANGLE* t,TRIANGLE* t1,TRIANGLE* t2,TRIANGLE* t3){
   else {
     // Find center point (the point on t1 not on s)
     R_POINT *cp;
-    cp = (R_POINT*) malloc(sizeof(R_POINT));
+    cp = NULL;
     if (!isEndPoint(t,t1->p1))
       cp = t1->p1;
     if (!isEndPoint(t,t1->p2))
@@ -1108,55 +1295,13 @@ void triangleCheck(TRIANGLE* t,TRIANGLE* t1,TRIANGLE* t2,TRIANGLE* t3){
 
 
 //
-// traverse through a TIN_TILE and free each triangle. Since the
-// traversal visits every triangle three times, we free each triangle
-// the third time we see it.
+// Free the triangles of a TIN_TILE. They are all in the arena of the
+// tile so no traversal is needed
 //
 void deleteTinTile(TIN_TILE *tt){
-
-  TRIANGLE *curT = tt->t;
-  TRIANGLE *prevT = curT;
-  
-  // Create an edge which 
-  EDGE curE;
-  curE.type = IN;
-  curE.t1 = NULL;
-  curE.t2 = tt->t;
-  curE.p1 = tt->e.p1;
-  curE.p2 = tt->e.p2;
-
-  // Remove the triangle the third time its seen.
-  do{
-    
-    if( (prevT->maxErrorValue >= -30000.0 || prevT->maxErrorValue <= -30003.0 )
-      && prevT != NULL){
-      prevT->maxErrorValue = -30001.0;
-    }
-    else if (prevT->maxErrorValue == -30001.0 && prevT != NULL){
-      prevT->maxErrorValue--;
-    }
-    else if (prevT->maxErrorValue == -30002.0 && prevT != NULL){
-      removeTri(prevT);
-      prevT->maxErrorValue--;
-    }
-    else {
-      assert(0);
-      char str[100];
-      sprintf(str,"Possible bad tin output %s\n",ELEV_TYPE_PRINT_CHAR);
-      printf(str, prevT->maxErrorValue);
-      exit(1);
-    }
-
-    // Go to next edge
-    prevT=curT;
-    curT = nextEdge(curT,tt->v,&curE,tt);
-    assert(curT);
-    
-  }while((curE.p1 != tt->e.p1 || curE.p2 != tt->e.p2) && 
-	 (curE.p1 != tt->e.p2 || curE.p2 != tt->e.p1));
-  
-  removeTri(tt->t);
-
+  freeTriArena(&tt->tris);
+  freeVertexPool(&tt->verts);
+  tt->t = NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1255,7 +1400,8 @@ TIN *readTinFileHeader(char *path){
 
 //
 // Read in the next tile from the already open tin file (tin->fp) and
-// return null if eof
+// return null if eof. The triangles and points are in the arena and
+// vertex pool of the tile, deleteTinTile frees them
 //
 TIN_TILE *readNextTile(TIN *tin){
  
@@ -1286,6 +1432,10 @@ TIN_TILE *readNextTile(TIN *tin){
   // Create a new tile
   //
   tt = (TIN_TILE*)malloc(sizeof(TIN_TILE));
+  assert(tt);
+  initTriArena(&tt->tris);
+  initVertexPool(&tt->verts);
+  tt->pointIndex = NULL;
 
   fread(&tt->iOffset,sizeof(COORD_TYPE), 1, tin->fp);
   fread(&tt->jOffset,sizeof(COORD_TYPE), 1, tin->fp);
@@ -1295,6 +1445,9 @@ TIN_TILE *readNextTile(TIN *tin){
   fread(&tt->numPoints,sizeof(unsigned int), 1, tin->fp);
 
   tt->nodata = tin->nodata;
+  tt->min = tin->min;
+  tt->max = tin->max;
+  tt->nodataZ = tin->min-1;
 
   // Array of triangles
   tris = (TRIANGLE**)malloc(tt->numTris*sizeof(TRIANGLE*));
@@ -1332,10 +1485,10 @@ TIN_TILE *readNextTile(TIN *tin){
 	 index < tt->numTris);
 
   // Setup the first triangle
-  t = (TRIANGLE*)malloc(sizeof(TRIANGLE));
-  pt1 = (R_POINT*)malloc(sizeof(R_POINT));
-  pt2 = (R_POINT*)malloc(sizeof(R_POINT));
-  pt3 = (R_POINT*)malloc(sizeof(R_POINT));
+  t = allocTri(tt);
+  pt1 = allocVertex(tt);
+  pt2 = allocVertex(tt);
+  pt3 = allocVertex(tt);
   tris[index] = t;
   pts[p1i] = pt1;
   pts[p2i] = pt2;
@@ -1352,6 +1505,7 @@ TIN_TILE *readNextTile(TIN *tin){
   t->p1 = pt1;
   t->p2 = pt2;
   t->p3 = pt3;
+  t->maxErrorValue = 0;
   t->p1p2 = NULL;
   t->p1p3 = NULL;
   t->p2p3 = NULL;
@@ -1452,12 +1606,12 @@ TIN_TILE *readNextTile(TIN *tin){
 
     // Does tri exist?
     if(tris[index]==NULL){
-      t = (TRIANGLE*)malloc(sizeof(TRIANGLE));
+      t = allocTri(tt);
 
       // Find the points that already exist
       //
       if(pts[p1i]==NULL){
-	pt1 = (R_POINT*)malloc(sizeof(R_POINT));
+	pt1 = allocVertex(tt);
 	pt1->x = p1.x;
 	pt1->y = p1.y;
 	pt1->z = p1.z;
@@ -1467,7 +1621,7 @@ TIN_TILE *readNextTile(TIN *tin){
 	pt1 = pts[p1i];
 
       if(pts[p2i]==NULL){
-	pt2 = (R_POINT*)malloc(sizeof(R_POINT));
+	pt2 = allocVertex(tt);
 	pt2->x = p2.x;
 	pt2->y = p2.y;
 	pt2->z = p2.z;
@@ -1477,7 +1631,7 @@ TIN_TILE *readNextTile(TIN *tin){
 	pt2 = pts[p2i];
 
       if(pts[p3i]==NULL){
-	pt3 = (R_POINT*)malloc(sizeof(R_POINT));
+	pt3 = allocVertex(tt);
 	pt3->x = p3.x;
 	pt3->y = p3.y;
 	pt3->z = p3.z;
@@ -1495,6 +1649,7 @@ TIN_TILE *readNextTile(TIN *tin){
       t->p1 = pt1;
       t->p2 = pt2;
       t->p3 = pt3;
+      t->maxErrorValue = 0;
       t->p1p2 = NULL;
       t->p1p3 = NULL;
       t->p2p3 = NULL;
@@ -1590,6 +1745,8 @@ TIN_TILE *readNextTile(TIN *tin){
   free(pts);
 
   if(tileNull){ // We didn't get a tile this time
+    freeTriArena(&tt->tris);
+    freeVertexPool(&tt->verts);
     free(tt);
     return NULL;
   }
@@ -1599,135 +1756,131 @@ TIN_TILE *readNextTile(TIN *tin){
 
 
 //
-// Get the index of a given point. First try the three previously
-// checked points and then Binary search the sorted points array to
-// find the index of the point. This assumes the array is sorted and
-// each point is unique!
+// Interpolate tile tt at the cells of its first nrows rows and ncols
+// columns into z, row major. A cell on the boundary of two triangles
+// takes the first of the arena, cells of no triangle are set to
+// empty. Unless keepNodata, the cells of the triangles with a nodata
+// corner are set to the nodata value, as they are not drawn
 //
-unsigned int getPointsIndex(R_POINT *p,TIN_TILE *tt,unsigned int p1,
-			    unsigned int p2, unsigned int p3){
-  int Low, Mid, High, comp;
-   
-  // Before binary searching for the point, lets see if its one of the
-  // three previous points
-/*   if(p1 > 0 && p1 < tt->pointsCount && p == tt->points[p1]) */
-/*     return p1; */
-/*   else if (p1 >= tt->pointsCount && p1 < tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->rPoints[p1-tt->pointsCount]) */
-/*     return p1; */
-/*   else if (p1 >= tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->bPoints[p1-tt->pointsCount-tt->rPointsCount]) */
-/*     return p1; */
-
-/*   if(p2 > 0 && p2 < tt->pointsCount && p == tt->points[p2]) */
-/*     return p2; */
-/*   else if (p2 >= tt->pointsCount && p2 < tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->rPoints[p2-tt->pointsCount]) */
-/*     return p2; */
-/*   else if (p2 >= tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->bPoints[p2-tt->pointsCount-tt->rPointsCount]) */
-/*     return p2; */
-
-/*   if(p3 > 0 && p3 < tt->pointsCount && p == tt->points[p3]) */
-/*     return p3; */
-/*   else if (p3 >= tt->pointsCount && p3 < tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->rPoints[p3-tt->pointsCount]) */
-/*     return p3; */
-/*   else if (p3 >= tt->pointsCount+tt->rPointsCount && */
-/* 	   p == tt->bPoints[p3-tt->pointsCount-tt->rPointsCount]) */
-/*     return p3; */
-  
-  //
-  // The point can be in one of five arrays so we need to search each of them
-  //
-
-  // Points array
-  Low = 0; High = tt->pointsCount-1;
-  while( Low <= High ){
-    Mid = ( Low + High ) / 2;
-    comp = QS_compPoints(&p,&tt->points[Mid]);
-    if(comp >= 1)
-      Low = Mid + 1;
-    else
-      if(comp <= -1 )
-	High = Mid - 1;
-      else
-	return Mid;  /* Found */
+void rasterTinTile(TIN_TILE *tt, long *z, COORD_TYPE nrows, COORD_TYPE ncols,
+		   long empty, int keepNodata){
+  COORD_TYPE lastRow = tt->iOffset + nrows - 1;
+  COORD_TYPE lastCol = tt->jOffset + ncols - 1;
+  unsigned int pos = 0;
+  long i, j, k, n = (long)nrows * ncols;
+  TRIANGLE *t;
+  R_POINT c;
+
+  assert(nrows <= tt->nrows && ncols <= tt->ncols);
+  for(k = 0; k < n; k++)
+    z[k] = empty;
+
+  while((t = nextTri(&tt->tris,&pos)) != NULL){
+    COORD_TYPE minX = MIN(t->p1->x,MIN(t->p2->x,t->p3->x));
+    COORD_TYPE maxX = MIN(MAX(t->p1->x,MAX(t->p2->x,t->p3->x)),lastRow);
+    COORD_TYPE minY = MIN(t->p1->y,MIN(t->p2->y,t->p3->y));
+    COORD_TYPE maxY = MIN(MAX(t->p1->y,MAX(t->p2->y,t->p3->y)),lastCol);
+    int isNodata = !keepNodata && 
+      (t->p1->z == tt->nodata || t->p2->z == tt->nodata ||
+       t->p3->z == tt->nodata || t->p1->z == tt->nodataZ ||
+       t->p2->z == tt->nodataZ || t->p3->z == tt->nodataZ);
+
+    for(i = minX; i <= maxX; i++){
+      for(j = minY; j <= maxY; j++){
+	int s0, s1, s2;
+	k = (i - tt->iOffset) * ncols + (j - tt->jOffset);
+	if(z[k] != empty)
+	  continue;
+	// In the triangle or on its boundary
+	c.x = i;
+	c.y = j;
+	s0 = areaSign(t->p1,t->p2,&c);
+	s1 = areaSign(t->p2,t->p3,&c);
+	s2 = areaSign(t->p3,t->p1,&c);
+	if(!((s0 >= 0 && s1 >= 0 && s2 >= 0) ||
+	     (s0 <= 0 && s1 <= 0 && s2 <= 0)))
+	  continue;
+	if(isNodata)
+	  z[k] = tt->nodata;
+	else
+	  z[k] = interpolate(t->p1,t->p2,t->p3,i,j);
+      }
+    }
   }
+}
 
-  // rPoints array
-  Low = 0; High = tt->rPointsCount-1;
-  while( Low <= High ){
-    Mid = ( Low + High ) / 2;
-    comp = QS_compPoints(&p,&tt->rPoints[Mid]);
-    if(comp >= 1)
-      Low = Mid + 1;
-    else
-      if(comp <= -1 )
-	High = Mid - 1;
-      else
-	return Mid+tt->pointsCount;  /* Found */
-  }
 
-  // bPoints array
-  Low = 0; High = tt->bPointsCount-2;
-  while( Low <= High ){
-    Mid = ( Low + High ) / 2;
-    comp = QS_compPoints(&p,&tt->bPoints[Mid]);
-    if(comp >= 1)
-      Low = Mid + 1;
-    else
-      if(comp <= -1 )
-	High = Mid - 1;
-      else
-	return Mid+tt->pointsCount+tt->rPointsCount;  /* Found */
-  }
-
-  /* left tile's right boundary points skip first and last point
-     (already included in arrays above) */
+//
+// Sort the point arrays of a tile by x then y and give every point
+// its index in the output file. The points are in the tile window so
+// they are radix sorted on their coordinates. The index of a point is
+// its place in the sorted arrays, in the order points, rPoints,
+// bPoints, the left tile's rPoints and the top tile's bPoints; a
+// point in two arrays gets the first
+//
+void sortTilePoints(TIN_TILE *tt){
+  unsigned int i, base;
+  long n = (long)tt->nrows * tt->ncols;
+
+  QS_radixPoints(tt->points, tt->pointsCount, tt->iOffset, tt->jOffset,
+		 tt->nrows, tt->ncols);
+  QS_radixPoints(tt->rPoints, tt->rPointsCount, tt->iOffset, tt->jOffset,
+		 tt->nrows, tt->ncols);
+  QS_radixPoints(tt->bPoints, tt->bPointsCount, tt->iOffset, tt->jOffset,
+		 tt->nrows, tt->ncols);
+
+  // All bits set is UINT_MAX, no point
+  tt->pointIndex = (unsigned int*)memAlloc(MEM_POINTS, 
+					   n * sizeof(unsigned int));
+  assert(tt->pointIndex);
+  memset(tt->pointIndex, 0xff, n * sizeof(unsigned int));
+
+  for(i = 0; i < tt->pointsCount; i++)
+    tt->pointIndex[POINT_CELL(tt,tt->points[i])] = i;
+  base = tt->pointsCount;
+
+  for(i = 0; i < tt->rPointsCount; i++)
+    if(tt->pointIndex[POINT_CELL(tt,tt->rPoints[i])] == UINT_MAX)
+      tt->pointIndex[POINT_CELL(tt,tt->rPoints[i])] = base + i;
+  base += tt->rPointsCount;
+
+  // The last of bPoints (se) is also in rPoints
+  for(i = 0; i+1 < tt->bPointsCount; i++)
+    if(tt->pointIndex[POINT_CELL(tt,tt->bPoints[i])] == UINT_MAX)
+      tt->pointIndex[POINT_CELL(tt,tt->bPoints[i])] = base + i;
+  base += tt->bPointsCount - 2;
+
+  // Boundary points of the neighbors, already sorted. Their first and
+  // last points are corners of this tile
   if(tt->left != NULL){
-     Low = 1; High = tt->left->rPointsCount-2;
-     while( Low <= High ){
-       Mid = ( Low + High ) / 2;
-       comp = QS_compPoints(&p,&tt->left->rPoints[Mid]);
-       if(comp >= 1)
-	 Low = Mid + 1;
-       else
-	 if(comp <= -1 )
-	   High = Mid - 1;
-      else
-	return Mid+tt->pointsCount+tt->rPointsCount+tt->bPointsCount-2; 
-     }
+    for(i = 1; i+1 < tt->left->rPointsCount; i++)
+      if(tt->pointIndex[POINT_CELL(tt,tt->left->rPoints[i])] == UINT_MAX)
+	tt->pointIndex[POINT_CELL(tt,tt->left->rPoints[i])] = base + i;
+    base += tt->left->rPointsCount - 2;
   }
-  
-  /* top tile's right boundary points skip first and last point
-     (already included in arrays above) */
   if(tt->top != NULL){
-     Low = 1; High = tt->top->bPointsCount-2;
-     while( Low <= High ){
-       Mid = ( Low + High ) / 2;
-       comp = QS_compPoints(&p,&tt->top->bPoints[Mid]);
-       if(comp >= 1)
-	 Low = Mid + 1;
-       else
-	 if(comp <= -1 )
-	   High = Mid - 1;
-      else
-	if(tt->left != NULL)
-	  return Mid+tt->pointsCount+tt->rPointsCount+tt->bPointsCount+
-	    tt->left->rPointsCount-4;
-	else
-	  return Mid+tt->pointsCount+tt->rPointsCount+tt->bPointsCount-2;
-     }
+    for(i = 1; i+1 < tt->top->bPointsCount; i++)
+      if(tt->pointIndex[POINT_CELL(tt,tt->top->bPoints[i])] == UINT_MAX)
+	tt->pointIndex[POINT_CELL(tt,tt->top->bPoints[i])] = base + i;
   }
+}
 
 
+//
+// Get the index of a given point in the output file. The index is
+// set by sortTilePoints
+//
+unsigned int getPointsIndex(R_POINT *p,TIN_TILE *tt){
+  assert(tt->pointIndex && pointInTile(p,tt));
+  unsigned int i = tt->pointIndex[POINT_CELL(tt,p)];
+
   // The point should be found else die;
-  assert(0);
-  printf("Point could not be found!\n");fflush(stdout);
-  exit(1);
-  return 0;
-  
+  if(i == UINT_MAX){
+    assert(0);
+    printf("Point could not be found!\n");fflush(stdout);
+    exit(1);
+  }
+  return i;
 }
 
 
@@ -1737,6 +1890,7 @@ unsigned int getPointsIndex(R_POINT *p,TIN_TILE *tt,unsigned int p1,
 void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
   FILE *outputf;
   unsigned int index = 0;
+  STATS_START(STAT_TILE_WRITE);
 
   // Validate output file
   if ((outputf = fopen(path, "ab"))== NULL){
@@ -1747,11 +1901,10 @@ void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
 
   TRIANGLE *curT = tt->t;
   TRIANGLE *prevT = curT;
+  TRIANGLE *t;
+  unsigned int pos;
 
-  // Store last three points
-  unsigned int lpi1 = 0;
-  unsigned int lpi2 = 0;
-  unsigned int lpi3 = 0;
+  // Output index of the three points
   unsigned int pi1 = 0;
   unsigned int pi2 = 0;
   unsigned int pi3 = 0;
@@ -1793,113 +1946,42 @@ void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
   fwrite(&tt->numTris,sizeof(unsigned int), 1, outputf);
   fwrite(&tt->numPoints,sizeof(unsigned int), 1, outputf);
 
+  // Triangles get their output index the first time the walk meets
+  // them, until then pqIndex is UINT_MAX
+  pos = 0;
+  while((t = nextTri(&tt->tris,&pos)) != NULL)
+    t->pqIndex = UINT_MAX;
+
+  // The walk meets every triangle three times and writes it each
+  // time, the reader links consecutive triangles into the mesh
   do{
-    // Print tri if we are on its IN edge
-    if( (prevT->maxErrorValue >= -30000.0 || prevT->maxErrorValue <= -30003.0 )
-      && prevT != NULL){
-      //This is the first time we see this triangle so index it and increment
+    if(prevT->pqIndex == UINT_MAX){
       prevT->pqIndex = index;
       index++;
+    }
 
-      pi1 = getPointsIndex(prevT->p1,tt,lpi1,lpi2,lpi3);
-      pi2 = getPointsIndex(prevT->p2,tt,lpi1,lpi2,lpi3);
-      pi3 = getPointsIndex(prevT->p3,tt,lpi1,lpi2,lpi3);
-      assert(pi1 < tt->numPoints && pi2 < tt->numPoints &&
-	     pi3 < tt->numPoints);
-
-      fwrite(&prevT->p1->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi1,sizeof(unsigned int), 1, outputf);
+    pi1 = getPointsIndex(prevT->p1,tt);
+    pi2 = getPointsIndex(prevT->p2,tt);
+    pi3 = getPointsIndex(prevT->p3,tt);
+    assert(pi1 < tt->numPoints && pi2 < tt->numPoints &&
+	   pi3 < tt->numPoints);
 
-      fwrite(&prevT->p2->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi2,sizeof(unsigned int), 1, outputf);
+    fwrite(&prevT->p1->x,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p1->y,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p1->z,sizeof(ELEV_TYPE), 1, outputf);
+    fwrite(&pi1,sizeof(unsigned int), 1, outputf);
 
-      fwrite(&prevT->p3->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi3,sizeof(unsigned int), 1, outputf);
+    fwrite(&prevT->p2->x,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p2->y,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p2->z,sizeof(ELEV_TYPE), 1, outputf);
+    fwrite(&pi2,sizeof(unsigned int), 1, outputf);
 
-      fwrite(&prevT->pqIndex,sizeof(unsigned int), 1, outputf);
+    fwrite(&prevT->p3->x,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p3->y,sizeof(COORD_TYPE), 1, outputf);
+    fwrite(&prevT->p3->z,sizeof(ELEV_TYPE), 1, outputf);
+    fwrite(&pi3,sizeof(unsigned int), 1, outputf);
 
-      lpi1 = pi1;
-      lpi2 = pi2;
-      lpi3 = pi3;
-
-      prevT->maxErrorValue = -30001.0;
-    }
-    else if (prevT->maxErrorValue == -30001.0 && prevT != NULL){
-
-      pi1 = getPointsIndex(prevT->p1,tt,lpi1,lpi2,lpi3);
-      pi2 = getPointsIndex(prevT->p2,tt,lpi1,lpi2,lpi3);
-      pi3 = getPointsIndex(prevT->p3,tt,lpi1,lpi2,lpi3);
-      assert(pi1 < tt->numPoints && pi2 < tt->numPoints &&
-	     pi3 < tt->numPoints);
-
-      fwrite(&prevT->p1->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi1,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->p2->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi2,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->p3->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi3,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->pqIndex,sizeof(unsigned int), 1, outputf);
-
-      lpi1 = pi1;
-      lpi2 = pi2;
-      lpi3 = pi3;
-      prevT->maxErrorValue--;
-    }
-    else if (prevT->maxErrorValue == -30002.0 && prevT != NULL){
-      
-      pi1 = getPointsIndex(prevT->p1,tt,lpi1,lpi2,lpi3);
-      pi2 = getPointsIndex(prevT->p2,tt,lpi1,lpi2,lpi3);
-      pi3 = getPointsIndex(prevT->p3,tt,lpi1,lpi2,lpi3);
-      assert(pi1 < tt->numPoints && pi2 < tt->numPoints &&
-	     pi3 < tt->numPoints);
-
-      fwrite(&prevT->p1->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p1->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi1,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->p2->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p2->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi2,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->p3->x,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->y,sizeof(COORD_TYPE), 1, outputf);
-      fwrite(&prevT->p3->z,sizeof(ELEV_TYPE), 1, outputf);
-      fwrite(&pi3,sizeof(unsigned int), 1, outputf);
-
-      fwrite(&prevT->pqIndex,sizeof(unsigned int), 1, outputf);
-      
-      if(freeTriangles &&  prevT != tt->t){
-	lpi1 = 0;
-	lpi2 = 0;
-	lpi3 = 0;
-	removeTri(prevT);
-      }
-      prevT->maxErrorValue--;
-    }
-    else {
-      assert(0);
-      char str[100];
-      sprintf(str,"Possible bad tin output %s\n",ELEV_TYPE_PRINT_CHAR);
-      printf(str, prevT->maxErrorValue);
-      exit(1);
-    }
+    fwrite(&prevT->pqIndex,sizeof(unsigned int), 1, outputf);
 
     // Go to next edge
     prevT=curT;
@@ -1911,20 +1993,23 @@ void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
 
   /* Index should not have gotten higher than number of triangles */
   assert(index <= tt->numTris);
+
+  memFree(MEM_POINTS, tt->pointIndex, 
+	  (long)tt->nrows * tt->ncols * sizeof(unsigned int));
+  tt->pointIndex = NULL;
   
   // Free all points for this tile
   //
   if(freeTriangles){
-    // Remove last triangle
-    removeTri(tt->t);
+    // Remove all triangles
+    freeTriArena(&tt->tris);
+    tt->t = NULL;
         
-    // Free tiles points
+    // Free tiles points. Except for the nw corner in points[0] they
+    // all come from the vertex pool
     int i = 0;
-    for(i = 0;i < tt->pointsCount; i++)
-      if( !(tt->points[i]->x == tt->iOffset &&
-	    tt->points[i]->y == tt->jOffset))
-	free(tt->points[i]);
-    free(tt->points);
+    freeVertexPool(&tt->verts);
+    memFree(MEM_POINTS, tt->points, tt->pointsSize * sizeof(R_POINT*));
     tt->points = NULL;
     
     //
@@ -1938,9 +2023,10 @@ void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
       // Assuming this is sorted we don't want to free the last point
       // as it is shared by the bPoints array
       for(i = 1;i < tt->left->rPointsCount-1; i++){
-	free(tt->left->rPoints[i]);
+	memFree(MEM_POINTS, tt->left->rPoints[i], sizeof(R_POINT));
       }
-      free(tt->left->rPoints);
+      memFree(MEM_POINTS, tt->left->rPoints, 
+	      tt->left->rPointsSize * sizeof(R_POINT*));
       tt->left->rPoints = NULL;
     }
     
@@ -1949,33 +2035,35 @@ void writeTinTile(TIN_TILE *tt, char *path, short freeTriangles){
       // Assuming this is sorted we don't want to free the last point
       // as it is shared by the bPoints array
       for(i = 0;i < tt->rPointsCount-1; i++){
-	free(tt->rPoints[i]);
+	memFree(MEM_POINTS, tt->rPoints[i], sizeof(R_POINT));
       }
-      free(tt->rPoints);
+      memFree(MEM_POINTS, tt->rPoints, tt->rPointsSize * sizeof(R_POINT*));
       tt->rPoints = NULL;
     }
     
     //Free point pointer array for tile above
     if(tt->top != NULL){
       for(i = 0;i < tt->top->bPointsCount-1; i++){
-	free(tt->top->bPoints[i]);
+	memFree(MEM_POINTS, tt->top->bPoints[i], sizeof(R_POINT));
       }
-      free(tt->top->bPoints);
+      memFree(MEM_POINTS, tt->top->bPoints, 
+	      tt->top->bPointsSize * sizeof(R_POINT*));
       tt->top->bPoints = NULL;
     }
     
     //Free tt's bottom array if it is on the bottom
     if(tt->bottom == NULL){
       for(i = 0;i < tt->bPointsCount-1; i++){
-	free(tt->bPoints[i]);
+	memFree(MEM_POINTS, tt->bPoints[i], sizeof(R_POINT));
       }
-      free(tt->bPoints);
+      memFree(MEM_POINTS, tt->bPoints, tt->bPointsSize * sizeof(R_POINT*));
       tt->bPoints = NULL;
     }
 
   }
   // Close file
   fclose(outputf);
+  STATS_STOP(STAT_TILE_WRITE);
 }
 
 
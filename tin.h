@@ -60,6 +60,48 @@ typedef struct Edge {
   short type;
 } EDGE;
 
+// Number of triangles in a block of a TRI_ARENA. The first block has
+// TRI_FIRST_BLOCK triangles and each next one twice as many, up to
+// TRI_BLOCK_SIZE, so the tiles waiting to be refined take the space
+// of their two initial triangles only
+#define TRI_BLOCK_SIZE 1024
+#define TRI_FIRST_BLOCK 2
+
+//
+// Storage of the triangles of a tile. Triangles are taken from
+// blocks of up to TRI_BLOCK_SIZE triangles and removed triangles are
+// kept on a stack to be reused, all are freed at once with the
+// tile. Removed triangles have p1 set to NULL until they are reused
+//
+typedef struct Tri_Arena {
+  TRIANGLE **blocks;
+  unsigned int numBlocks;
+  unsigned int blocksSize;
+  unsigned int used;         // triangles taken from the last block
+  TRIANGLE **freeTris;       // removed triangles
+  unsigned int freeCount;
+  unsigned int freeSize;
+} TRI_ARENA;
+
+// Number of vertices in a block of a VERTEX_POOL
+#define VERTEX_BLOCK_SIZE 4096
+
+//
+// Storage of the vertices inserted in the interior of a tile. They
+// are taken in insertion order from blocks of VERTEX_BLOCK_SIZE points
+// and freed at once after the tile is written
+//
+typedef struct Vertex_Pool {
+  R_POINT **blocks;
+  unsigned int numBlocks;
+  unsigned int blocksSize;
+  unsigned int used;         // vertices taken from the last block
+} VERTEX_POOL;
+
+// Cell of point p in the row major order of tile tt
+#define POINT_CELL(tt,p) ((long)((p)->x - (tt)->iOffset) * (tt)->ncols + \
+			  ((p)->y - (tt)->jOffset))
+
 typedef struct Tin_Tile {
   TRIANGLE *t;       // lower left most tri
   R_POINT* v;          // lower left vertex of t
@@ -72,6 +114,7 @@ typedef struct Tin_Tile {
   COORD_TYPE jOffset;     // j offset for tile
   ELEV_TYPE min;         // minimum height in this tile
   ELEV_TYPE max;         // max height in this tile
+  ELEV_TYPE nodataZ;     // height used for nodata points (global min-1)
   struct Tin_Tile *top;     // Top neighbor tile
   struct Tin_Tile *bottom;  // Bottom neighbor tile
   struct Tin_Tile *right;   // Right neighbor tile
@@ -84,6 +127,9 @@ typedef struct Tin_Tile {
   R_POINT* se;
   unsigned int numTris;     // number of triangles in the tile
   unsigned int numPoints;   // number of points in the tile
+  TRI_ARENA tris;           // storage of the triangles of the tile
+  VERTEX_POOL verts;        // storage of the vertices in points
+  unsigned int *pointIndex; // output index of the point in each cell
   // Points should not contain any points from bPoints or rPoints,
   // bPoints and rPoints should have one point in common
   R_POINT **points;          // 1D array of pointers to points in this tile
@@ -93,7 +139,43 @@ typedef struct Tin_Tile {
   unsigned int pointsCount;
   unsigned int bPointsCount;
   unsigned int rPointsCount;
+  // Allocated length of above arrays
+  unsigned int pointsSize;
+  unsigned int bPointsSize;
+  unsigned int rPointsSize;
   FILE *gridFile;
+  TILE_STATS gridStats;      // statistics of gridFile from ingestion
+  // Edge swaps: no point of a triangle consumed by an edge swap is
+  // freed before the Delaunay cascade is finished. With lazy swaps
+  // the point lists are pooled in swapPool and the triangles created
+  // by the swaps are kept in dirtyTris. swapPool is NULL when points
+  // are redistributed on every swap, the done triangles created by
+  // the swaps then keep their points in dirtyTris. swapping is set
+  // while edgeSwap redistributes points
+  QUEUE *swapPool;
+  unsigned int swapPoolCount;
+  unsigned int swapPoolSize;
+  TRIANGLE **dirtyTris;
+  unsigned int dirtyCount;
+  unsigned int dirtySize;
+  short swapping;
+  // Seeding: the max error point of each block of the seed lattice,
+  // found while the tile is read. NULL when not seeding
+  R_POINT *seeds;
+  ELEV_TYPE *seedErr;
+  unsigned int seedRows;
+  unsigned int seedCols;
+  // Batched refinement: the edges of the triangles of a round still
+  // to be checked for Delaunay, the edge of batchTris[i] opposite
+  // batchPts[i]. NULL when not refining in batches
+  TRIANGLE **batchTris;
+  R_POINT **batchPts;
+  unsigned int batchCount;
+  unsigned int batchSize;
+  // Convergence curve: points inserted so far and the smallest error
+  // of an inserted point
+  unsigned int curveCount;
+  ELEV_TYPE curveMin;
 
 } TIN_TILE;
 
@@ -201,9 +283,46 @@ short edgeOnBoundary(R_POINT *p1, R_POINT *p2, TIN_TILE *tt);
 TRIANGLE *nextEdge(TRIANGLE *t, R_POINT *v, EDGE *edge, TIN_TILE *tt);
 
 //
-// Remove triangle from TIN_TILE and free memory
+// Remove triangle from TIN_TILE, its memory is reused by the tile
+//
+void removeTri(TIN_TILE *tt, TRIANGLE* t);
+
+//
+// Initialize an empty triangle arena
+//
+void initTriArena(TRI_ARENA *a);
+
+//
+// Get memory for a triangle from the arena of tile tt
+//
+TRIANGLE *allocTri(TIN_TILE *tt);
+
+//
+// Free all the triangles of an arena
+//
+void freeTriArena(TRI_ARENA *a);
+
+//
+// Get the next live triangle of arena a after position *pos and
+// advance *pos, NULL when all triangles were visited. Start with
+// *pos = 0, every triangle of the tile is returned once
+//
+TRIANGLE *nextTri(TRI_ARENA *a, unsigned int *pos);
+
+//
+// Initialize an empty vertex pool
 //
-void removeTri(TRIANGLE* t);
+void initVertexPool(VERTEX_POOL *vp);
+
+//
+// Get memory for an interior vertex from the pool of tile tt
+//
+R_POINT *allocVertex(TIN_TILE *tt);
+
+//
+// Free all the vertices of a pool
+//
+void freeVertexPool(VERTEX_POOL *vp);
 
 //
 // printPointList - given a triangle,print its point list
@@ -226,6 +345,13 @@ int areaSign(R_POINT *a, R_POINT *b, R_POINT *c);
 //
 int inTri2D(R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *z);
 
+//
+// Does triangle abc own point z? Returns 1 if z is inside abc or on
+// an edge that abc owns, -1 if z is on an edge owned by the other
+// triangle of the edge and 0 if z is not in abc
+//
+int ownsPoint2D(R_POINT *a, R_POINT *b, R_POINT *c, R_POINT *z);
+
 //
 // Validate that all points in a triangle's point list are actually in
 // that triangle
@@ -293,18 +419,36 @@ TIN *readTinFileHeader(char *path);
 
 //
 // Read in the next tile from the already open tin file (tin->fp) and
-// return null if eof
+// return null if eof. The triangles and points are in the arena and
+// vertex pool of the tile, deleteTinTile frees them
 //
 TIN_TILE *readNextTile(TIN *tin);
 
 //
-// Get the index of a given point. First try the three previously
-// checked points and then Binary search the sorted points array to
-// find the index of the point. This assumes the array is sorted and
-// each point is unique!
+// Interpolate tile tt at the cells of its first nrows rows and ncols
+// columns into z, row major. A cell on the boundary of two triangles
+// takes the first of the arena, cells of no triangle are set to
+// empty. Unless keepNodata, the cells of the triangles with a nodata
+// corner are set to the nodata value, as they are not drawn
+//
+void rasterTinTile(TIN_TILE *tt, long *z, COORD_TYPE nrows, COORD_TYPE ncols,
+		   long empty, int keepNodata);
+
+//
+// Sort the point arrays of a tile by x then y and give every point
+// its index in the output file. The points are in the tile window so
+// they are radix sorted on their coordinates. The index of a point is
+// its place in the sorted arrays, in the order points, rPoints,
+// bPoints, the left tile's rPoints and the top tile's bPoints; a
+// point in two arrays gets the first
+//
+void sortTilePoints(TIN_TILE *tt);
+
+//
+// Get the index of a given point in the output file. The index is
+// set by sortTilePoints
 //
-unsigned int getPointsIndex(R_POINT *p,TIN_TILE *tt,unsigned int p1,
-			    unsigned int p2, unsigned int p3);
+unsigned int getPointsIndex(R_POINT *p,TIN_TILE *tt);
 
 //
 // Write tile to a file
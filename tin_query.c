@@ -0,0 +1,283 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * tin_query.c answers elevation queries on a TIN written by r.refine
+ * with the locator of query.h
+ *
+ * usage: tin_query tin input [threads]
+ *        tin_query tin -bench n [threads]
+ *        tin_query tin -profile x0 y0 x1 y1
+ *        tin_query tin -los input h0 h1 [threads]
+ *        tin_query tin -losbench n [threads]
+ *
+ * The input has one query "x y" per line, in the coordinates of the
+ * TIN (row and column of the grid), and "x y z" is printed for each.
+ * With -bench, n queries uniform over the grid are answered and the
+ * time to read the TIN, to build the locator and to answer the
+ * queries is printed, with the queries/s. threads defaults to the
+ * number of processors.
+ *
+ * -profile prints the points "s x y z" of the profile of the TIN
+ * along a segment. -los reads sight lines "x0 y0 x1 y1" and prints
+ * each with 1 if the target h1 above (x1,y1) is visible from the
+ * observer h0 above (x0,y0), 0 if not and -1 if an end is off the
+ * grid. -losbench times n random sight lines.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "tin.h"
+#include "query.h"
+#include "rtimer.h"
+
+static unsigned int queryRand = 2463534242u;
+
+
+//
+// xorshift
+//
+static inline unsigned int nextRand(){
+  queryRand ^= queryRand << 13;
+  queryRand ^= queryRand >> 17;
+  queryRand ^= queryRand << 5;
+  return queryRand;
+}
+
+
+//
+// Read the lines of k numbers of a file into the columns col[0..k-1],
+// return the number of lines
+//
+long readColumns(char *path, int k, double **col){
+  long n = 0, size = 1024;
+  double v[4];
+  FILE *fp;
+  int c, got;
+
+  assert(k <= 4);
+  if((fp = fopen(path, "r")) == NULL){
+    fprintf(stderr, "tin_query: can't open %s ", path);
+    perror("tin_query:");
+    exit(1);
+  }
+  for(c = 0; c < k; c++){
+    col[c] = (double*)malloc(size * sizeof(double));
+    assert(col[c]);
+  }
+  while(1){
+    for(got = 0; got < k && fscanf(fp, "%lf", &v[got]) == 1; got++)
+      ;
+    if(got < k)
+      break;
+    if(n == size){
+      size *= 2;
+      for(c = 0; c < k; c++){
+	col[c] = (double*)realloc(col[c], size * sizeof(double));
+	assert(col[c]);
+      }
+    }
+    for(c = 0; c < k; c++)
+      col[c][n] = v[c];
+    n++;
+  }
+  fclose(fp);
+  return n;
+}
+
+
+//
+// Random point of the grid of tin
+//
+void randomPoint(TIN *tin, double *x, double *y){
+  *x = (double)nextRand() / 4294967296.0 * (tin->nrows - 1);
+  *y = (double)nextRand() / 4294967296.0 * (tin->ncols - 1);
+}
+
+
+//
+// Time n random sight lines of length up to a quarter of the grid,
+// with the observer and the target 2 above the TIN. A grid viewshed
+// would sample about one cell per unit of length of each line
+//
+void benchLos(TIN_INDEX *ix, long n, int numThreads){
+  TIN *tin = ix->tin;
+  double *x0 = (double*)malloc(n * sizeof(double));
+  double *y0 = (double*)malloc(n * sizeof(double));
+  double *x1 = (double*)malloc(n * sizeof(double));
+  double *y1 = (double*)malloc(n * sizeof(double));
+  signed char *visible = (signed char*)malloc(n);
+  double reach = MIN(tin->nrows, tin->ncols) / 4.0, cells = 0;
+  long i, numVisible = 0, points = 0;
+  PROFILE p;
+  Rtimer rt;
+  assert(x0 && y0 && x1 && y1 && visible);
+
+  for(i = 0; i < n; i++){
+    double a = (double)nextRand() / 4294967296.0 * 2 * M_PI;
+    double r = (double)nextRand() / 4294967296.0 * reach;
+    randomPoint(tin,&x0[i],&y0[i]);
+    x1[i] = MAX(0, MIN(tin->nrows - 1, x0[i] + r * cos(a)));
+    y1[i] = MAX(0, MIN(tin->ncols - 1, y0[i] + r * sin(a)));
+    cells += MAX(fabs(x1[i] - x0[i]), fabs(y1[i] - y0[i]));
+  }
+
+  ix->walkSteps = 0;
+  ix->fallbacks = 0;
+  rt_start(rt);
+  losBatch(ix,x0,y0,x1,y1,2,2,visible,n,numThreads);
+  rt_stop(rt);
+
+  // Profile sizes, apart from the timing
+  memset(&p, 0, sizeof(PROFILE));
+  for(i = 0; i < n; i++){
+    numVisible += visible[i] == 1;
+    profileSegment(ix,x0[i],y0[i],x1[i],y1[i],&p);
+    points += p.count;
+  }
+  printf("sight_lines=%ld los_per_s=%.0f visible=%ld fallbacks=%lu\n", n,
+	 n / (rt_w_useconds(rt) / 1000000), numVisible, ix->fallbacks);
+  printf("profile_points_per_line=%.2f grid_cells_per_line=%.2f\n",
+	 (double)points / n, cells / n);
+  free(p.pts);
+  free(x0);
+  free(y0);
+  free(x1);
+  free(y1);
+  free(visible);
+}
+
+
+int main(int argc, char *argv[]){
+  int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  char *mode = argc > 2 ? argv[2] : "";
+  int args = 1, k;
+  long n, i;
+  double *col[4], *z;
+  TIN *tin;
+  TIN_INDEX *ix;
+  Rtimer rtRead, rtBuild, rtQuery;
+
+  // Arguments after the tin and the mode, before the threads
+  if(strcmp(mode,"-bench") == 0 || strcmp(mode,"-losbench") == 0)
+    args = 2;
+  else if(strcmp(mode,"-los") == 0)
+    args = 4;
+  else if(strcmp(mode,"-profile") == 0)
+    args = 5;
+  if(argc < 2 + args){
+    printf("usage: %s tin input [threads]\n"
+	   "       %s tin -bench n [threads]\n"
+	   "       %s tin -profile x0 y0 x1 y1\n"
+	   "       %s tin -los input h0 h1 [threads]\n"
+	   "       %s tin -losbench n [threads]\n",
+	   argv[0], argv[0], argv[0], argv[0], argv[0]);
+    exit(1);
+  }
+  if(argc > 2 + args)
+    numThreads = atoi(argv[2 + args]);
+  if(numThreads < 1)
+    numThreads = 1;
+
+  rt_start(rtRead);
+  tin = readTinFile(argv[1]);
+  rt_stop(rtRead);
+  rt_start(rtBuild);
+  ix = buildTinIndex(tin);
+  rt_stop(rtBuild);
+
+  if(strcmp(mode,"-profile") == 0){
+    PROFILE p;
+    memset(&p, 0, sizeof(PROFILE));
+    if(!profileSegment(ix,atof(argv[3]),atof(argv[4]),atof(argv[5]),
+		       atof(argv[6]),&p)){
+      printf("tin_query: the segment is off the grid\n");
+      exit(1);
+    }
+    for(k = 0; k < p.count; k++)
+      printf("%.6f %.4f %.4f %.4f\n", p.pts[k].s, p.pts[k].x, p.pts[k].y,
+	     p.pts[k].z);
+    free(p.pts);
+    return 0;
+  }
+
+  if(strcmp(mode,"-los") == 0){
+    signed char *visible;
+    n = readColumns(argv[3],4,col);
+    visible = (signed char*)malloc(n);
+    assert(visible);
+    losBatch(ix,col[0],col[1],col[2],col[3],atof(argv[4]),atof(argv[5]),
+	     visible,n,numThreads);
+    for(i = 0; i < n; i++)
+      printf("%g %g %g %g %d\n", col[0][i], col[1][i], col[2][i], col[3][i],
+	     visible[i]);
+    return 0;
+  }
+
+  if(strcmp(mode,"-losbench") == 0){
+    printf("triangles=%u buckets=%u threads=%d\n", ix->numTris,
+	   ix->numBuckets, numThreads);
+    benchLos(ix,atol(argv[3]),numThreads);
+    return 0;
+  }
+
+  if(strcmp(mode,"-bench") == 0){
+    n = atol(argv[3]);
+    col[0] = (double*)malloc(n * sizeof(double));
+    col[1] = (double*)malloc(n * sizeof(double));
+    assert(col[0] && col[1]);
+    for(i = 0; i < n; i++)
+      randomPoint(tin,&col[0][i],&col[1][i]);
+  }
+  else
+    n = readColumns(argv[2],2,col);
+  z = (double*)malloc(n * sizeof(double));
+  assert(z);
+
+  ix->walkSteps = 0;
+  ix->fallbacks = 0;
+  rt_start(rtQuery);
+  queryBatch(ix,col[0],col[1],z,n,numThreads);
+  rt_stop(rtQuery);
+
+  if(strcmp(mode,"-bench") == 0){
+    printf("triangles=%u buckets=%u threads=%d\n", ix->numTris,
+	   ix->numBuckets, numThreads);
+    printf("read=%.3fs build=%.3fs query=%.3fs\n",
+	   rt_w_useconds(rtRead) / 1000000, rt_w_useconds(rtBuild) / 1000000,
+	   rt_w_useconds(rtQuery) / 1000000);
+    printf("queries=%ld queries_per_s=%.0f steps_per_query=%.2f "
+	   "fallbacks=%lu\n", n, n / (rt_w_useconds(rtQuery) / 1000000),
+	   n ? (double)ix->walkSteps / n : 0, ix->fallbacks);
+  }
+  else
+    for(i = 0; i < n; i++)
+      printf("%g %g %.4f\n", col[0][i], col[1][i], z[i]);
+
+  freeTinIndex(ix);
+  free(col[0]);
+  free(col[1]);
+  free(z);
+  return 0;
+}
@@ -0,0 +1,242 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * tin_raster.c converts a TIN written by r.refine back to a grid of
+ * the size of the original one. Each cell gets the height of the
+ * TIN's plane at the cell, as interpolate computes it.
+ *
+ * usage: tin_raster tin output [asc|raw] [threads]
+ *
+ * The output is an Arc-ASCII grid (asc, the default) or the rows of
+ * heights as raw ELEV_TYPE values in the byte order of the machine
+ * (raw), whose size is printed. Cells of no triangle and of the
+ * triangles with a nodata corner get the nodata value of the TIN.
+ *
+ * The grid is made one band at a time. A band is the rows of a row
+ * of tiles, whose TIN tiles are read with readNextTile and scan
+ * converted by threads threads (default the number of processors),
+ * then the band is written and its tiles freed. So only one row of
+ * tiles is in memory.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "point.h"
+#include "triangle.h"
+#include "tin.h"
+#include "rtimer.h"
+
+//
+// A band of the output grid and its TIN tiles
+//
+typedef struct raster_band {
+  TIN_TILE **tiles;        // tiles of the band, in file order
+  int numTiles;
+  int next;                // next tile to scan convert
+  pthread_mutex_t mutex;
+  COORD_TYPE iOffset;      // first row of the band
+  COORD_TYPE nrows;        // rows of the band
+  ELEV_TYPE *cells;        // nrows x ncols of the grid
+} RASTER_BAND;
+
+static TIN *rTin;
+static RASTER_BAND rBand;
+
+
+//
+// Scan convert tile tt into its part of the band. A tile owns its
+// rows and columns but the last ones, which belong to the next tile,
+// unless they are the last of the grid
+//
+void rasterTile(TIN_TILE *tt, long *z){
+  COORD_TYPE nrows = rBand.nrows, ncols = tt->ncols;
+  long i, j, v;
+
+  assert(tt->iOffset == rBand.iOffset);
+  assert(nrows <= tt->nrows);
+  if(tt->jOffset + ncols < rTin->ncols)
+    ncols--;
+  rasterTinTile(tt,z,nrows,ncols,LONG_MIN,0);
+
+  for(i = 0; i < nrows; i++)
+    for(j = 0; j < ncols; j++){
+      v = z[i*ncols+j];
+      if(v == LONG_MIN)
+	v = rTin->nodata;
+      if(v > ELEV_TYPE_MAX)
+	v = ELEV_TYPE_MAX;
+      if(v < ELEV_TYPE_MIN)
+	v = ELEV_TYPE_MIN;
+      rBand.cells[i*rTin->ncols + tt->jOffset + j] = v;
+    }
+}
+
+
+//
+// Thread scan converting the next tile of the band until there are
+// none left
+//
+void *rasterWorker(void *arg){
+  long *z = (long*)malloc((long)rTin->tl * rTin->tl * sizeof(long));
+  int k;
+  assert(z);
+
+  while(1){
+    pthread_mutex_lock(&rBand.mutex);
+    k = rBand.next++;
+    pthread_mutex_unlock(&rBand.mutex);
+    if(k >= rBand.numTiles)
+      break;
+    rasterTile(rBand.tiles[k],z);
+  }
+  free(z);
+  return NULL;
+}
+
+
+//
+// Write the band to fp
+//
+void writeBand(FILE *fp, int ascii){
+  long i, j, n = (long)rBand.nrows * rTin->ncols;
+
+  if(!ascii){
+    if(fwrite(rBand.cells,sizeof(ELEV_TYPE),n,fp) != n){
+      perror("tin_raster: write");
+      exit(1);
+    }
+    return;
+  }
+  for(i = 0; i < rBand.nrows; i++){
+    for(j = 0; j < rTin->ncols; j++)
+      fprintf(fp, "%d ", rBand.cells[i*rTin->ncols+j]);
+    fprintf(fp, "\n");
+  }
+}
+
+
+int main(int argc, char *argv[]){
+  int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int ascii = 1, numBands, b, i, jNumTiles;
+  long k;
+  unsigned int numTiles = 0;
+  TIN_TILE *pending;
+  pthread_t *threads;
+  FILE *fp;
+  Rtimer rt;
+
+  if(argc < 3 || (argc > 3 && strcmp(argv[3],"asc") != 0 &&
+		  strcmp(argv[3],"raw") != 0)){
+    printf("usage: %s tin output [asc|raw] [threads]\n", argv[0]);
+    exit(1);
+  }
+  if(argc > 3)
+    ascii = strcmp(argv[3],"asc") == 0;
+  if(argc > 4)
+    numThreads = atoi(argv[4]);
+  if(numThreads < 1)
+    numThreads = 1;
+
+  rt_start(rt);
+  rTin = readTinFileHeader(argv[1]);
+  if((fp = fopen(argv[2], ascii ? "w" : "wb")) == NULL){
+    fprintf(stderr, "tin_raster: can't write to %s ", argv[2]);
+    perror("tin_raster:");
+    exit(1);
+  }
+  if(ascii){
+    fprintf(fp, "ncols\t\t%d\n", rTin->ncols);
+    fprintf(fp, "nrows\t\t%d\n", rTin->nrows);
+    fprintf(fp, "xllcorner\t%f\n", rTin->x);
+    fprintf(fp, "yllcorner\t%f\n", rTin->y);
+    fprintf(fp, "cellsize\t%f\n", rTin->cellsize);
+    fprintf(fp, "NODATA_value\t%d\n", rTin->nodata);
+  }
+
+  // Same tiling as r.refine
+  numBands = ceil(((double)rTin->nrows) / ((double)rTin->tl-1));
+  jNumTiles = ceil(((double)rTin->ncols) / ((double)rTin->tl-1));
+  rBand.tiles = (TIN_TILE**)malloc(jNumTiles * sizeof(TIN_TILE*));
+  rBand.cells = (ELEV_TYPE*)malloc((long)(rTin->tl-1) * rTin->ncols *
+				   sizeof(ELEV_TYPE));
+  threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
+  assert(rBand.tiles && rBand.cells && threads);
+  pthread_mutex_init(&rBand.mutex, NULL);
+
+  pending = readNextTile(rTin);
+  for(b = 0; b < numBands; b++){
+    rBand.iOffset = b * (rTin->tl-1);
+    rBand.nrows = (b == numBands - 1) ? rTin->nrows - rBand.iOffset :
+      rTin->tl - 1;
+    for(k = 0; k < (long)rBand.nrows * rTin->ncols; k++)
+      rBand.cells[k] = rTin->nodata;
+
+    // The tiles are written by rows of tiles, a band ends at the first
+    // tile of a later band. Empty tiles are not in the file
+    rBand.numTiles = 0;
+    rBand.next = 0;
+    while(pending != NULL && pending->iOffset == rBand.iOffset){
+      assert(rBand.numTiles < jNumTiles);
+      rBand.tiles[rBand.numTiles++] = pending;
+      pending = readNextTile(rTin);
+    }
+    if(pending != NULL && pending->iOffset < rBand.iOffset){
+      printf("tin_raster: tile [%d, %d] is out of order\n",
+	     pending->iOffset, pending->jOffset);
+      exit(1);
+    }
+
+    for(i = 0; i < numThreads && i < rBand.numTiles; i++)
+      if(pthread_create(&threads[i],NULL,rasterWorker,NULL) != 0){
+	perror("tin_raster: pthread_create");
+	exit(1);
+      }
+    while(--i >= 0)
+      pthread_join(threads[i],NULL);
+
+    writeBand(fp,ascii);
+    for(i = 0; i < rBand.numTiles; i++){
+      deleteTinTile(rBand.tiles[i]);
+      free(rBand.tiles[i]);
+    }
+    numTiles += rBand.numTiles;
+  }
+  if(pending != NULL){
+    printf("tin_raster: tile [%d, %d] is out of the grid\n",
+	   pending->iOffset, pending->jOffset);
+    exit(1);
+  }
+  fclose(fp);
+  rt_stop(rt);
+
+  if(!ascii)
+    printf("raw: nrows=%d ncols=%d bytes/cell=%lu nodata=%d\n",
+	   rTin->nrows, rTin->ncols, sizeof(ELEV_TYPE), rTin->nodata);
+  printf("tiles=%u bands=%d threads=%d time=%.2fs\n", numTiles, numBands,
+	 numThreads, rt_w_useconds(rt) / 1000000);
+  return 0;
+}
@@ -0,0 +1,345 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * tin_verify.c measures the true vertical error of a TIN written by
+ * r.refine against the grid it was built from. Every grid cell is
+ * located in its triangle and compared with the height interpolated
+ * there, as findError does during the refinement.
+ *
+ * usage: tin_verify grid.asc tin [threads] [worst] [maxerr]
+ *
+ * The grid is split into tile files like r.refine does, and the TIN
+ * is read one tile at a time with readNextTile, so only one grid tile
+ * and one TIN tile per thread are in memory. The threads take the
+ * next tile of the TIN file in turn. threads defaults to the number
+ * of processors and worst, the number of cells with the largest error
+ * to list, to 10.
+ *
+ * Nodata cells are not checked. A cell on the boundary of two tiles
+ * or two triangles is checked once. Valid cells that no triangle
+ * covers are counted apart. With maxerr the exit status is 1 if a
+ * cell has a larger error or if a valid cell is not covered, so the
+ * tool can check the output of a run.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "point.h"
+#include "triangle.h"
+#include "tin.h"
+#include "grid.h"
+#include "geom_tin.h"
+#include "rtimer.h"
+
+//
+// A checked cell and its error
+//
+typedef struct verify_cell {
+  COORD_TYPE row;
+  COORD_TYPE col;
+  ELEV_TYPE z;          // height in the grid
+  long tinZ;            // height interpolated in the TIN
+  ELEV_TYPE err;
+} VERIFY_CELL;
+
+//
+// Errors of the tiles checked by one thread
+//
+typedef struct verify_result {
+  unsigned long cells;      // valid cells checked
+  unsigned long uncovered;  // valid cells in no triangle
+  unsigned long over;       // cells with an error above maxerr
+  unsigned int tiles;
+  double sumErr;
+  double sumSq;
+  ELEV_TYPE maxErr;
+  VERIFY_CELL *worst;       // largest errors, decreasing
+  int numWorst;
+} VERIFY_RESULT;
+
+static TIN *vTin;
+static TILED_GRID *vGrid;
+static pthread_mutex_t vReadMutex = PTHREAD_MUTEX_INITIALIZER;
+static int vNumWorst = 10;
+static double vMaxErr = -1;
+
+// Tiles of the grid found in the TIN, by tile row and column
+static char **vTileSeen;
+static int vINumTiles, vJNumTiles;
+
+
+//
+// Add a cell to the largest errors of r if it is one of them
+//
+void addWorst(VERIFY_RESULT *r, VERIFY_CELL *c){
+  int k;
+
+  if(r->numWorst == vNumWorst &&
+     (vNumWorst == 0 || c->err <= r->worst[vNumWorst-1].err))
+    return;
+  if(r->numWorst < vNumWorst)
+    r->numWorst++;
+  for(k = r->numWorst - 1; k > 0 && r->worst[k-1].err < c->err; k--)
+    r->worst[k] = r->worst[k-1];
+  r->worst[k] = *c;
+}
+
+
+//
+// Number of rows (cols) of grid tile ti of a grid of n rows (cols)
+//
+static COORD_TYPE tileSide(unsigned long n, int ti){
+  unsigned long start = (unsigned long)ti * (vGrid->TL-1);
+  return (start + vGrid->TL > n) ? n - start : vGrid->TL;
+}
+
+
+//
+// Read the heights of grid tile (ti,tj), nrows x ncols in row major
+// order
+//
+ELEV_TYPE *readGridTile(int ti, int tj, COORD_TYPE nrows, COORD_TYPE ncols){
+  long n = (long)nrows * ncols;
+  ELEV_TYPE *buf = (ELEV_TYPE*)malloc(n * sizeof(ELEV_TYPE));
+  FILE *fp = vGrid->files[ti][tj];
+  assert(buf);
+
+  rewind(fp);
+  if(fread(buf,sizeof(ELEV_TYPE),n,fp) != n){
+    printf("tin_verify: cannot read grid tile [%d, %d]\n", ti, tj);
+    exit(1);
+  }
+  return buf;
+}
+
+
+//
+// Check the cells of TIN tile tt. A tile owns its rows and columns
+// but the last ones, which belong to the next tile, unless they are
+// the last of the grid
+//
+void verifyTile(TIN_TILE *tt, VERIFY_RESULT *r){
+  int ti = tt->iOffset / (vGrid->TL-1), tj = tt->jOffset / (vGrid->TL-1);
+  COORD_TYPE nrows = tt->nrows, ncols = tt->ncols;
+  ELEV_TYPE *buf;
+  long *z;
+  long i, j;
+  VERIFY_CELL v;
+
+  assert(tt->iOffset % (vGrid->TL-1) == 0 && tt->jOffset % (vGrid->TL-1) == 0);
+  assert(ti < vINumTiles && tj < vJNumTiles);
+  assert(tt->nrows == tileSide(vGrid->nrows,ti) &&
+	 tt->ncols == tileSide(vGrid->ncols,tj));
+  vTileSeen[ti][tj] = 1;
+
+  if(ti < vINumTiles - 1)
+    nrows--;
+  if(tj < vJNumTiles - 1)
+    ncols--;
+
+  buf = readGridTile(ti,tj,tt->nrows,tt->ncols);
+  z = (long*)malloc((long)nrows * ncols * sizeof(long));
+  assert(z);
+  rasterTinTile(tt,z,nrows,ncols,LONG_MIN,1);
+
+  for(i = 0; i < nrows; i++){
+    for(j = 0; j < ncols; j++){
+      ELEV_TYPE h = buf[i*tt->ncols+j];
+      if(h == vGrid->nodata)
+	continue;
+      if(z[i*ncols+j] == LONG_MIN){
+	r->uncovered++;
+	continue;
+      }
+
+      // As findError
+      v.row = tt->iOffset + i;
+      v.col = tt->jOffset + j;
+      v.z = h;
+      v.tinZ = z[i*ncols+j];
+      v.err = fabs((ELEV_TYPE)h - v.tinZ);
+      r->cells++;
+      r->sumErr += v.err;
+      r->sumSq += (double)v.err * v.err;
+      if(v.err > r->maxErr)
+	r->maxErr = v.err;
+      if(vMaxErr >= 0 && v.err > vMaxErr)
+	r->over++;
+      addWorst(r,&v);
+    }
+  }
+
+  r->tiles++;
+  free(z);
+  free(buf);
+}
+
+
+//
+// Thread checking the next tile of the TIN until there are none
+// left. Only the reads of the TIN file are serialized
+//
+void *verifyWorker(void *arg){
+  VERIFY_RESULT *r = (VERIFY_RESULT*)arg;
+  TIN_TILE *tt;
+
+  while(1){
+    pthread_mutex_lock(&vReadMutex);
+    tt = readNextTile(vTin);
+    pthread_mutex_unlock(&vReadMutex);
+    if(tt == NULL)
+      break;
+    verifyTile(tt,r);
+    deleteTinTile(tt);
+    free(tt);
+  }
+  return NULL;
+}
+
+
+//
+// Count the valid cells of the grid tiles with no TIN tile, which are
+// not covered by the TIN
+//
+unsigned long countMissingTiles(){
+  unsigned long missing = 0;
+  int ti, tj;
+  long i, j;
+
+  for(ti = 0; ti < vINumTiles; ti++)
+    for(tj = 0; tj < vJNumTiles; tj++){
+      COORD_TYPE nrows = tileSide(vGrid->nrows,ti);
+      COORD_TYPE ncols = tileSide(vGrid->ncols,tj);
+      COORD_TYPE lastRow = nrows - 1, lastCol = ncols - 1;
+      ELEV_TYPE *buf;
+      if(vTileSeen[ti][tj] || vGrid->stats[ti][tj].numValid == 0)
+	continue;
+      if(ti < vINumTiles - 1)
+	lastRow--;
+      if(tj < vJNumTiles - 1)
+	lastCol--;
+      buf = readGridTile(ti,tj,nrows,ncols);
+      for(i = 0; i <= lastRow; i++)
+	for(j = 0; j <= lastCol; j++)
+	  if(buf[i*ncols+j] != vGrid->nodata)
+	    missing++;
+      free(buf);
+    }
+  return missing;
+}
+
+
+int main(int argc, char *argv[]){
+  int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  VERIFY_RESULT *res, total;
+  pthread_t *threads;
+  int i, k;
+  Rtimer rt;
+
+  if(argc < 3){
+    printf("usage: %s grid.asc tin [threads] [worst] [maxerr]\n", argv[0]);
+    exit(1);
+  }
+  if(argc > 3)
+    numThreads = atoi(argv[3]);
+  if(argc > 4)
+    vNumWorst = atoi(argv[4]);
+  if(argc > 5)
+    vMaxErr = atof(argv[5]);
+  if(numThreads < 1)
+    numThreads = 1;
+  if(vNumWorst < 0)
+    vNumWorst = 0;
+
+  rt_start(rt);
+  vTin = readTinFileHeader(argv[2]);
+  // The runs of valid cells are not needed to check the TIN
+  vGrid = readGrid2Tile(argv[1],vTin->tl,NULL,1);
+  if(vGrid->nrows != vTin->nrows || vGrid->ncols != vTin->ncols){
+    printf("tin_verify: grid is %lu x %lu but the TIN is %d x %d\n",
+	   vGrid->nrows, vGrid->ncols, vTin->nrows, vTin->ncols);
+    exit(1);
+  }
+
+  vINumTiles = ceil(((double)vGrid->nrows) / ((double)vGrid->TL-1));
+  vJNumTiles = ceil(((double)vGrid->ncols) / ((double)vGrid->TL-1));
+  vTileSeen = (char**)malloc(vINumTiles * sizeof(char*));
+  assert(vTileSeen);
+  for(i = 0; i < vINumTiles; i++){
+    vTileSeen[i] = (char*)calloc(vJNumTiles, sizeof(char));
+    assert(vTileSeen[i]);
+  }
+
+  res = (VERIFY_RESULT*)calloc(numThreads, sizeof(VERIFY_RESULT));
+  threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
+  assert(res && threads);
+  for(i = 0; i < numThreads; i++){
+    res[i].worst = (VERIFY_CELL*)malloc((vNumWorst+1) * sizeof(VERIFY_CELL));
+    assert(res[i].worst);
+    if(pthread_create(&threads[i],NULL,verifyWorker,&res[i]) != 0){
+      perror("tin_verify: pthread_create");
+      exit(1);
+    }
+  }
+
+  // Fold the results of the threads
+  memset(&total, 0, sizeof(VERIFY_RESULT));
+  total.worst = (VERIFY_CELL*)malloc((vNumWorst+1) * sizeof(VERIFY_CELL));
+  assert(total.worst);
+  for(i = 0; i < numThreads; i++){
+    pthread_join(threads[i],NULL);
+    total.cells += res[i].cells;
+    total.uncovered += res[i].uncovered;
+    total.over += res[i].over;
+    total.tiles += res[i].tiles;
+    total.sumErr += res[i].sumErr;
+    total.sumSq += res[i].sumSq;
+    if(res[i].maxErr > total.maxErr)
+      total.maxErr = res[i].maxErr;
+    for(k = 0; k < res[i].numWorst; k++)
+      addWorst(&total,&res[i].worst[k]);
+  }
+  total.uncovered += countMissingTiles();
+  rt_stop(rt);
+
+  printf("tiles=%u/%d cells=%lu uncovered=%lu\n", total.tiles,
+	 vINumTiles * vJNumTiles, total.cells, total.uncovered);
+  printf("max=%d mean=%.4f rms=%.4f\n", total.maxErr,
+	 total.cells ? total.sumErr / total.cells : 0,
+	 total.cells ? sqrt(total.sumSq / total.cells) : 0);
+  if(vMaxErr >= 0)
+    printf("maxerr=%.4f over=%lu\n", vMaxErr, total.over);
+  for(k = 0; k < total.numWorst; k++)
+    printf("worst %d: row=%d col=%d grid=%d tin=%ld error=%d\n", k+1,
+	   total.worst[k].row, total.worst[k].col, total.worst[k].z,
+	   total.worst[k].tinZ, total.worst[k].err);
+  printf("threads=%d time=%.2fs\n", numThreads, rt_w_useconds(rt) / 1000000);
+
+  if(vMaxErr >= 0 && (total.over > 0 || total.uncovered > 0))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,127 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * trace.c records the phases of the run as a timeline in the Chrome
+ * trace event format
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "trace.h"
+
+int traceOn = 0;
+
+static FILE *traceFp = NULL;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static double traceStartTime;
+
+// Thread id of the calling thread in the trace, 0 for the main
+// thread and the worker number + 1 for the workers
+static __thread int traceTid = 0;
+
+// The rows of the thread ids below traceNamed have their name
+static int traceNamed = 0;
+
+
+//
+// Wall clock in microseconds
+//
+static double traceNow(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+
+//
+// Start recording a trace to path
+//
+void traceOpen(char *path){
+  if((traceFp = fopen(path, "w")) == NULL){
+    fprintf(stderr, "traceOpen: can't write to %s ",path);
+    perror("traceOpen:");
+    exit(1);
+  }
+  traceStartTime = traceNow();
+  traceOn = 1;
+  fprintf(traceFp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+	  "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+	  "\"tid\": 0, \"args\": {\"name\": \"r.refine\"}}");
+}
+
+
+//
+// Set the row of the calling worker thread in the trace. Workers are
+// created for each parallel step, numbering them keeps their events
+// on a few rows
+//
+void traceThread(int worker){
+  traceTid = worker + 1;
+}
+
+
+//
+// Record a begin ('B') or end ('E') event of phase name on the
+// calling thread. The event of a tile has its offsets as arguments,
+// they are -1 for other events
+//
+void traceEvent(char *name, char ph, int iOffset, int jOffset){
+  double ts = traceNow() - traceStartTime;
+
+  pthread_mutex_lock(&traceMutex);
+  if(traceFp == NULL){
+    pthread_mutex_unlock(&traceMutex);
+    return;
+  }
+  // Name the rows up to the one of this thread
+  for(; traceNamed <= traceTid; traceNamed++){
+    fprintf(traceFp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+	    "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", traceNamed);
+    if(traceNamed == 0)
+      fprintf(traceFp, "\"main\"}}");
+    else
+      fprintf(traceFp, "\"worker %d\"}}", traceNamed - 1);
+  }
+  fprintf(traceFp, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.0f, "
+	  "\"pid\": 1, \"tid\": %d", name, ph, ts, traceTid);
+  if(iOffset >= 0)
+    fprintf(traceFp, ", \"args\": {\"iOffset\": %d, \"jOffset\": %d}",
+	    iOffset, jOffset);
+  fprintf(traceFp, "}");
+  pthread_mutex_unlock(&traceMutex);
+}
+
+
+//
+// Finish the trace file
+//
+void traceClose(){
+  pthread_mutex_lock(&traceMutex);
+  if(traceFp != NULL){
+    fprintf(traceFp, "\n]}\n");
+    fclose(traceFp);
+    traceFp = NULL;
+  }
+  traceOn = 0;
+  pthread_mutex_unlock(&traceMutex);
+}
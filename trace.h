@@ -0,0 +1,62 @@
+/* ************************************************************
+*
+*  MODULE:	r.refine
+*
+*  Authors:	Jon Todd <jonrtodd@gmail.com>,  Laura Toma <ltoma@bowdoin.edu>
+ * 		        Bowdoin College, USA
+*
+*  Purpose:	convert grid data to TIN
+*
+*  COPYRIGHT:
+*			This program is free software under the GNU General Public
+*	       		License (>=v2). Read the file COPYING that comes with GRASS
+*              	for details.
+*
+*
+************************************************************  */
+
+/******************************************************************************
+ *
+ * trace.h records the phases of the run as a timeline in the Chrome
+ * trace event format
+ *
+ * COMMENTS:
+ *
+ * Each phase is a begin and an end event on the thread that runs it,
+ * so the file opens in chrome://tracing or Perfetto with one row per
+ * thread. Nothing is recorded unless traceOpen was called.
+ *
+ *****************************************************************************/
+
+#ifndef __trace_h
+#define __trace_h
+
+// Is a trace being recorded?
+extern int traceOn;
+
+#define TRACE_BEGIN(name) if(traceOn) traceEvent(name,'B',-1,-1)
+#define TRACE_END(name) if(traceOn) traceEvent(name,'E',-1,-1)
+
+//
+// Start recording a trace to path
+//
+void traceOpen(char *path);
+
+//
+// Set the row of the calling worker thread in the trace
+//
+void traceThread(int worker);
+
+//
+// Record a begin ('B') or end ('E') event of phase name on the
+// calling thread. The event of a tile has its offsets as arguments,
+// they are -1 for other events
+//
+void traceEvent(char *name, char ph, int iOffset, int jOffset);
+
+//
+// Finish the trace file
+//
+void traceClose();
+
+#endif
@@ -34,15 +34,17 @@
 #include "point.h"
 
 
+// The pointers come first and the two small fields last, so that
+// they share the padding at the end: 72 bytes instead of 80 on 64-bit
 typedef struct Triangle {
   R_POINT *maxE;            // Pointer to the point with the max error
   R_POINT *p1,*p2,*p3;      // Three corner points
-  ELEV_TYPE maxErrorValue;  // Value of the max error point
   struct Triangle* p1p2;    // Neighbor triangle
   struct Triangle* p1p3;    // Neighbor triangle
   struct Triangle* p2p3;    // Neighbor triangle
-  unsigned int pqIndex;     // Pointer to this triangles in the PQ
   QUEUE points;             // Queue of points inside the tri (NULL if done)
-} TRIANGLE; 
+  unsigned int pqIndex;     // Pointer to this triangles in the PQ
+  ELEV_TYPE maxErrorValue;  // Value of the max error point
+} TRIANGLE;
 
 #endif